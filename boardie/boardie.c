@@ -221,6 +221,7 @@ void resetRadio() {}
 int initCodeFile(uint8 *flash, int flashByteCount) { return 0; }
 void writeCodeFile(uint8 *code, int byteCount) { }
 void writeCodeFileWord(int word) { }
+void syncCodeFile() { }
 void clearCodeFile(int ignore) { }
 void BLE_setEnabled(int enableFlag) { }
 
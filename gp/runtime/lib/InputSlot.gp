@@ -574,6 +574,14 @@ method typesMenu InputSlot {
   return menu
 }
 
+method packedArrayTypeMenu InputSlot {
+  menu = (menu nil (action 'setContents' this) true)
+  addItem menu 'int16'
+  addItem menu 'int32'
+  addItem menu 'float32'
+  return menu
+}
+
 method buttonMenu InputSlot {
   menu = (menu nil (action 'setContents' this) true)
   addItem menu 'A'
@@ -188,13 +188,30 @@ method microBlocksSpecs SmallCompiler {
 	'Data-Advanced'
 		(array 'r' 'newList'				'new list length _ : with all _' 'num auto' 10 0)
 		(array 'r' '[data:newByteArray]'	'new byte array _ : with all _' 'num num' 5 0)
+		(array ' ' '[data:ensureCapacity]'	'ensure list _ has room for _ items' 'auto num' nil 100)
+		(array 'r' '[data:newPackedArray]'	'new packed array _ : of _' 'auto menu.packedArrayTypeMenu' 100 'int16')
+		'-'
+		(array ' ' '[data:vectorAdd]'		'add _ to vector _' 'auto auto' 1)
+		(array ' ' '[data:vectorScale]'		'scale vector _ by _ : / _' 'auto num num' nil 1 2)
+		(array ' ' '[data:vectorClamp]'		'clamp vector _ between _ and _' 'auto num num' nil 0 100)
+		(array 'r' '[data:vectorSum]'		'sum of vector _' 'auto')
+		(array 'r' '[data:vectorMean]'		'mean of vector _' 'auto')
+		(array 'r' '[data:vectorMin]'		'min of vector _' 'auto')
+		(array 'r' '[data:vectorMax]'		'max of vector _' 'auto')
+		(array 'r' '[data:vectorMinIndex]'	'index of min of vector _' 'auto')
+		(array 'r' '[data:vectorMaxIndex]'	'index of max of vector _' 'auto')
+		(array 'r' '[data:vectorDot]'		'dot product of vectors _ _' 'auto auto')
+		(array 'r' '[data:vectorCrossings]'	'crossings of vector _ at threshold _' 'auto num' nil 0)
+		(array 'r' '[data:vectorMovingAverage]'	'moving average of vector _ window _' 'auto num' nil 8)
 		'-'
 		(array 'r' '[data:unicodeAt]'		'unicode _ of _' 'num str' 2 'cat')
 		(array 'r' '[data:unicodeString]'	'string from unicode _' 'num' 65)
+		(array 'r' '[data:newStringBuilder]'	'new string builder : capacity _' 'num' 100)
 		'-'
 		(array 'r' '[data:asByteArray]'		'as byte array _' 'auto' 'aByteListOrString')
 		'-'
 		(array 'r' '[data:freeMemory]'		'free memory')
+		(array 'r' '[data:heapStats]'		'heap statistics')
 
 	// The following block specs allow primitives to be rendered correctly
 	// even if the primitive spec was not included in the project or library.
@@ -486,12 +503,12 @@ method initOpcodes SmallCompiler {
 		spiSend 97
 		spiRecv 98
 	RESERVED 99
-	RESERVED 100
-	RESERVED 101
-	RESERVED 102
-	RESERVED 103
-	RESERVED 104
-	RESERVED 105
+		pushLocalConstOp 100	// superinstructions (see fuseInstructions)
+		pushGlobalConstOp 101
+		pushLocalConstJmp 102
+		pushGlobalConstJmp 103
+		updateLocal 104
+		updateGlobal 105
 	RESERVED 106
 	RESERVED 107
 	RESERVED 108
@@ -623,6 +640,7 @@ method instructionsFor SmallCompiler aBlockOrFunction {
 		addAll result (instructionsForCmdList this (newReporter 'return' cmdOrReporter))
 	}
 	add result (array 'codeEnd' 0)
+	fuseInstructions this result
 	if (((count result) % 2) == 1) {
 		// Ensure that there are an even number of 16-bit instruction words so that any
 		// literal string objects following the instructions are aligned to a 32-bit word
@@ -634,6 +652,48 @@ method instructionsFor SmallCompiler aBlockOrFunction {
 	return result
 }
 
+// superinstructions
+
+method fuseInstructions SmallCompiler instructions {
+	// Replace the first instruction of some common instruction sequences with a superinstruction
+	// that the VM executes in a single step when the operands are integers. The remaining
+	// instructions of the sequence are left in place, so jump offsets do not change and the VM
+	// can fall back to running the original sequence. Requires VM version 304 or later.
+	// Since fusion depends on the VM version, so do the compiled bytes and their CRCs; after
+	// switching between VMs older and newer than 304, the IDE resends every chunk once.
+
+	if (not (supportsSuperinstructions (smallRuntime))) { return }
+	binaryOps = (array '+' '-' '*' '/' '&' '|' '^' '<<' '>>' '<' '<=' '==' '!=' '>=' '>')
+	comparisonOps = (array '<' '<=' '==' '!=' '>=' '>')
+	i = 1
+	while (i <= ((count instructions) - 3)) {
+		op = (first (at instructions i))
+		constant = (at instructions (i + 1))
+		binaryOp = (at instructions (i + 2))
+		if (and (isOneOf op 'pushLocal' 'pushGlobal')
+				('pushImmediate' == (first constant))
+				(1 == ((at constant 2) & 1)) // integer constant
+				(contains binaryOps (first binaryOp))
+				(2 == (at binaryOp 2))) {
+			isLocal = ('pushLocal' == op)
+			nextOp = (first (at instructions (i + 3)))
+			if (and (contains comparisonOps (first binaryOp)) (isOneOf nextOp 'jmpTrue' 'jmpFalse')) {
+				if isLocal { fusedOp = 'pushLocalConstJmp' } else { fusedOp = 'pushGlobalConstJmp' }
+			} (and isLocal ('storeLocal' == nextOp)) {
+				fusedOp = 'updateLocal'
+			} (and (not isLocal) ('storeGlobal' == nextOp)) {
+				fusedOp = 'updateGlobal'
+			} else {
+				if isLocal { fusedOp = 'pushLocalConstOp' } else { fusedOp = 'pushGlobalConstOp' }
+			}
+			atPut instructions i (array fusedOp (at (at instructions i) 2))
+			i += 3
+		} else {
+			i += 1
+		}
+	}
+}
+
 // instruction generation: when hat block
 
 method instructionsForWhenCondition SmallCompiler cmdOrReporter {
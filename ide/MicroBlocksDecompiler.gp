@@ -221,6 +221,11 @@ method extractOpcodes MicroBlocksDecompiler chunkData {
 	while (and (i < byteCount) ('codeEnd' != op)) { // stop if last op was codeEnd
 		addr = (round (i / 2)) // 16-bit instruction address (1-based)
 		op = (at opcodeToName ((at chunkData i) + 1)) // opcode
+		if (isOneOf op 'pushLocalConstOp' 'pushLocalConstJmp' 'updateLocal') {
+			op = 'pushLocal' // superinstruction; the rest of the original sequence follows it
+		} (isOneOf op 'pushGlobalConstOp' 'pushGlobalConstJmp' 'updateGlobal') {
+			op = 'pushGlobal'
+		}
 		arg = (at chunkData (i + 1)) // arg byte
 		extraWords = 0
 		primCall = nil
@@ -1199,6 +1199,10 @@ if (contains (commandLine) '--allowMorphMenu') { // xxx testing (used by John)
 	  }
 	}
 	addItem menu 'compact code store' (action 'sendMsg' (smallRuntime) 'systemResetMsg' 2 nil)
+	addItem menu 'show task stack usage' (action 'sendMsg' (smallRuntime) 'getTaskStatsMsg' 0 nil)
+	addItem menu 'show heap statistics' (action 'showHeapStats' (smallRuntime))
+	addItem menu 'start profiling' (action 'startProfiling' (smallRuntime))
+	addItem menu 'stop profiling and show results' (action 'stopProfiling' (smallRuntime))
 	addLine menu
 	addItem menu 'autoload board libraries' (action 'toggleBoardLibAutoLoad' this) nil (newCheckmark this (not (boardLibAutoLoadDisabled this)))
 	addItem menu 'PlugShare when project empty' (action 'toggleAutoDecompile' this) 'when plugging a board, automatically read its contents into the IDE even if the current project is empty' (newCheckmark this (autoDecompileEnabled this))
@@ -14,7 +14,7 @@ to smallRuntime aScripter {
 	return (global 'smallRuntime')
 }
 
-defineClass SmallRuntime ideVersion latestVmVersion scripter chunkIDs chunkRunning chunkStopping msgDict portName port connectionStartTime lastScanMSecs pingSentMSecs lastPingRecvMSecs recvBuf oldVarNames vmVersion boardType lastBoardDrives loggedData loggedDataNext loggedDataCount vmInstallMSecs disconnected crcDict lastCRC lastRcvMSecs readFromBoard decompiler decompilerStatus blockForResultImage fileTransferMsgs fileTransferProgress fileTransfer firmwareInstallTimer recompileAll
+defineClass SmallRuntime ideVersion latestVmVersion scripter chunkIDs chunkRunning chunkStopping msgDict portName port connectionStartTime lastScanMSecs pingSentMSecs lastPingRecvMSecs recvBuf oldVarNames vmVersion boardType lastBoardDrives loggedData loggedDataNext loggedDataCount vmInstallMSecs disconnected crcDict lastCRC lastRcvMSecs readFromBoard decompiler decompilerStatus blockForResultImage fileTransferMsgs fileTransferProgress fileTransfer firmwareInstallTimer recompileAll profileData chunkBatch lastBatchAck
 
 method scripter SmallRuntime { return scripter }
 method serialPortOpen SmallRuntime { return (notNil port) }
@@ -1136,6 +1136,13 @@ method openPortAndSendPing SmallRuntime {
 method ideVersion SmallRuntime { return ideVersion }
 method latestVmVersion SmallRuntime { return latestVmVersion }
 
+method supportsSuperinstructions SmallRuntime {
+	// Return true if the connected VM supports the superinstructions used by the compiler.
+	// Note: The answer changes the compiled code, and thus the chunk CRCs (see fuseInstructions).
+
+	return (and (notNil vmVersion) (vmVersion >= 304))
+}
+
 method ideVersionNumber SmallRuntime {
 	// Return the version number portion of the version string (i.e. just digits and periods).
 
@@ -1452,6 +1459,7 @@ method saveAllChunks SmallRuntime checkCRCs {
 	}
 	assignFunctionIDs this
 	removeObsoleteChunks this
+	beginChunkBatch this
 
 	functionsSaved = 0
 	for aFunction (allFunctions (project scripter)) {
@@ -1463,11 +1471,13 @@ method saveAllChunks SmallRuntime checkCRCs {
 		}
 		if (not (connectedToBoard this)) { // connection closed
 		    print 'Lost communication to the board in saveAllChunks'
+		    dropChunkBatch this
 		    setCursor 'default'
 		    return
 		}
 		processedScripts += 1
 	}
+	sendChunkBatch this
 	if (functionsSaved > 0) { print 'Downloaded' functionsSaved 'functions to board' (join '(' (msecSplit t) ' msecs)') }
 
 	scriptsSaved = 0
@@ -1481,12 +1491,14 @@ method saveAllChunks SmallRuntime checkCRCs {
 			}
             if (not (connectedToBoard this)) { // connection closed
                 print 'Lost communication to the board in saveAllChunks'
+                dropChunkBatch this
                 setCursor 'default'
                 return
             }
 		}
 		processedScripts += 1
 	}
+	endChunkBatch this
 	if (scriptsSaved > 0) { print 'Downloaded' scriptsSaved 'scripts to board' (join '(' (msecSplit t) ' msecs)') }
 
 	recompileAll = false
@@ -1614,7 +1626,10 @@ method saveChunk SmallRuntime aBlockOrFunction skipHiddenFunctions {
 // 	atPut entry 2 (computeCRC this chunkBytes) // remember the CRC of the code we just saved
 
 	chunkCRC = (computeCRC this chunkBytes)
-	if (storeChunkOnBoard this chunkID data chunkCRC) {
+	if (notNil chunkBatch) {
+		add chunkBatch (array chunkID data chunkCRC entry)
+		atPut entry 2 chunkCRC // cleared by sendChunkBatch or dropChunkBatch if the save fails
+	} (storeChunkOnBoard this chunkID data chunkCRC) {
 		atPut entry 2 chunkCRC // remember the CRC of the code we just saved
 	} else {
         print 'Failed to save chunk:' chunkID
@@ -1623,6 +1638,7 @@ method saveChunk SmallRuntime aBlockOrFunction skipHiddenFunctions {
 
 	// restart the chunk if it was running
 	if restartChunk {
+		sendChunkBatch this // the new code must be on the board before restarting
 		stopRunningChunk this chunkID
 		waitForResponse this
 		runChunk this chunkID
@@ -1650,6 +1666,109 @@ method storeChunkOnBoard SmallRuntime chunkID data chunkCRC {
 	return (lastCRC == chunkCRC)
 }
 
+// Chunk Batches
+
+method beginChunkBatch SmallRuntime {
+	// Start collecting chunks to send to the board as a batch. Chunks are collected until
+	// endChunkBatch is called. Batches require VM version 306 or later.
+
+	if (or (isNil vmVersion) (vmVersion < 306) ('boardie' == portName)) { return }
+	chunkBatch = (list)
+}
+
+method endChunkBatch SmallRuntime {
+	sendChunkBatch this
+	chunkBatch = nil
+}
+
+method dropChunkBatch SmallRuntime {
+	// Discard the chunks collected but not yet sent (e.g. when the connection is lost).
+	// saveChunk records the CRC of a batched chunk when it is collected, so clear those CRCs
+	// to make sure that the chunks are sent again on the next save.
+
+	if (notNil chunkBatch) {
+		for item chunkBatch {
+			atPut (at item 4) 2 nil
+		}
+	}
+	chunkBatch = nil
+}
+
+method sendChunkBatch SmallRuntime {
+	// Send the chunks collected so far to the board. Chunks are sent in windows of at most
+	// eight chunks that fit into the board's receive buffer. The board acknowledges each
+	// window with the sequence number of the last chunk it received in order. Sending stops
+	// at the first gap and the chunks the board did not receive are sent individually.
+
+	if (or (isNil chunkBatch) (isEmpty chunkBatch)) { return }
+	batch = chunkBatch
+	chunkBatch = (list)
+
+	maxWindowChunks = 8
+	maxWindowBytes = 900 // less than the board's receive buffer
+	lastSeq = -1
+	windowChunks = 0
+	windowBytes = 0
+	ok = true
+	seq = 0
+	for item batch {
+		if ok {
+			byteList = (list (seq & 255) ((seq >> 8) & 255))
+			addAll byteList (at item 2)
+			msgBytes = ((count byteList) + 6)
+			if (and (windowChunks > 0) (or (windowChunks >= maxWindowChunks) ((windowBytes + msgBytes) > maxWindowBytes))) {
+				lastSeq = (waitForBatchAck this false)
+				ok = (lastSeq == (seq - 1))
+				windowChunks = 0
+				windowBytes = 0
+			}
+			if ok {
+				sendMsg this 'chunkBatchMsg' (at item 1) byteList
+				windowChunks += 1
+				windowBytes += msgBytes
+				seq += 1
+			}
+		}
+	}
+	lastSeq = (waitForBatchAck this true)
+
+	// send any chunks the board did not receive individually
+	for i (count batch) {
+		if (i > (lastSeq + 1)) { // sequence numbers start at zero
+			item = (at batch i)
+			if (not (storeChunkOnBoard this (at item 1) (at item 2) (at item 3))) {
+				print 'Failed to save chunk:' (at item 1)
+				atPut (at item 4) 2 nil // save failed; clear CRC
+			}
+		}
+	}
+}
+
+method waitForBatchAck SmallRuntime endOfBatch {
+	// Ask the board for the sequence number of the last batched chunk it received in order
+	// and wait for its reply. At the end of a batch, the board first commits the chunks to
+	// its code store.
+	// Return -1 if no chunks were received or there was no reply.
+
+	lastBatchAck = nil
+	if endOfBatch {
+		sendMsg this 'chunkBatchAckMsg' 1
+	} else {
+		sendMsg this 'chunkBatchAckMsg' 0
+	}
+	// Allow time for a code store compaction, which can take several seconds in Flash. It is
+	// usually done when the batch is committed, but boards without a batch buffer store each
+	// chunk as it arrives. The board's reply resets the ping timer.
+	timeout = 15000
+	startT = (msecsSinceStart)
+	while (and (isNil lastBatchAck) (((msecsSinceStart) - startT) < timeout)) {
+		processMessages this
+		waitMSecs 1
+	}
+	if (isNil lastBatchAck) { return -1 }
+	return lastBatchAck
+}
+
 method computeCRC SmallRuntime chunkData {
 	// Return the CRC for the given compiled code.
 
@@ -1853,6 +1972,100 @@ method allCRCsReceived SmallRuntime data {
 	}
 }
 
+method taskStatsReceived SmallRuntime data {
+	// Print the task stack usage reported by the board.
+	// Each task record is 6 bytes: <chunkID> <status> <stack size (2 bytes)> <high-water mark (2 bytes)>
+
+	if (isEmpty data) { return }
+	print 'Task stack usage (max tasks:' (at data 1) ')'
+	i = 2
+	while (i <= ((count data) - 5)) {
+		chunkID = (at data i)
+		status = (at (array 'done' 'waiting' 'running') ((at data (i + 1)) + 1))
+		stackSize = ((at data (i + 2)) + (256 * (at data (i + 3))))
+		highWater = ((at data (i + 4)) + (256 * (at data (i + 5))))
+		print '  chunk' chunkID status 'stack' stackSize 'words, high-water mark' highWater
+		i += 6
+	}
+}
+
+// Profiler (requires a VM compiled with -DPROFILER)
+
+method showHeapStats SmallRuntime {
+	// Ask the board to output its heap statistics. Older VMs would treat this as a reset.
+
+	if (or (isNil vmVersion) (vmVersion < 305)) {
+		inform 'Heap statistics require VM version 305 or later.'
+		return
+	}
+	sendMsg this 'systemResetMsg' 6
+}
+
+method startProfiling SmallRuntime {
+	profileData = nil
+	sendMsg this 'profileMsg' 1
+}
+
+method stopProfiling SmallRuntime {
+	sendMsg this 'profileMsg' 0
+	sendMsg this 'profileMsg' 2 // request results
+}
+
+method profileDataReceived SmallRuntime recordType data {
+	// Collect profile records from the board. Print the results when the summary record,
+	// which is always sent last, arrives. Record types:
+	//	0: summary: <elapsed usecs> <GC count> <GC usecs> <message count> <message usecs> <words allocated>
+	//	1: chunk: <chunkID> <dispatch count>
+	//	2: opcode: <opcode> <dispatch count>
+	//	3: primitive: <primitive set index> <call count> <usecs> <primitive name>
+	//	4: allocation site: <chunkID> <instruction index> <allocation count> <words allocated>
+	// Counts and times are 4 bytes, least significant byte first.
+
+	if (isNil profileData) { profileData = (list) }
+	if (0 != recordType) {
+		add profileData (array recordType data)
+		return
+	}
+	compiler = (initialize (new 'SmallCompiler'))
+	chunks = (list)
+	ops = (list)
+	prims = (list)
+	sites = (list)
+	for rec profileData {
+		d = (at rec 2)
+		kind = (at rec 1)
+		if (1 == kind) {
+			add chunks (array (profileUInt32 this d 2) (join 'chunk ' (at d 1)))
+		} (2 == kind) {
+			add ops (array (profileUInt32 this d 2) (keyAtValue (opcodes compiler) (at d 1)))
+		} (3 == kind) {
+			primName = (join '[' (keyAtValue (primsets compiler) (at d 1)) ':' (callWith 'string' (copyFromTo d 10)) ']')
+			add prims (array (profileUInt32 this d 6) primName (profileUInt32 this d 2))
+		} (4 == kind) {
+			site = (join 'chunk ' (at d 1) ' instruction ' (profileUInt32 this d 2))
+			add sites (array (profileUInt32 this d 10) site (profileUInt32 this d 6))
+		}
+	}
+	profileData = nil
+	byCount = (function a b { return ((first a) > (first b)) })
+
+	print 'Profile:' ((profileUInt32 this data 1) / 1000) 'msecs;' (profileUInt32 this data 5) 'GCs taking' ((profileUInt32 this data 9) / 1000) 'msecs;' (profileUInt32 this data 13) 'messages taking' ((profileUInt32 this data 17) / 1000) 'msecs;' (profileUInt32 this data 21) 'words allocated'
+	print 'Opcode dispatches by chunk:'
+	for r (sorted chunks byCount) { print '  ' (at r 2) (at r 1) }
+	print 'Opcode dispatches by opcode:'
+	for r (sorted ops byCount) { print '  ' (at r 2) (at r 1) }
+	print 'Primitive time (usecs):'
+	for r (sorted prims byCount) { print '  ' (at r 2) (at r 1) 'usecs' (at r 3) 'calls' }
+	print 'Allocations by site (words):'
+	for r (sorted sites byCount) { print '  ' (at r 2) (at r 1) 'words' (at r 3) 'allocations' }
+}
+
+method profileUInt32 SmallRuntime data i {
+	// Return the unsigned 32-bit integer starting at index i of data (least significant byte first).
+
+	return (+ (at data i) ((at data (i + 1)) << 8) ((at data (i + 2)) << 16) ((at data (i + 3)) << 24))
+}
+
 method saveVariableNames SmallRuntime {
 	// If the variables list has changed, save the new variable names.
 	// Return true if varibles have changed, false otherwise.
@@ -2002,6 +2215,12 @@ method msgNameToID SmallRuntime msgName {
 		atPut msgDict 'chunkCode16Msg' 32
 		atPut msgDict 'getAllCRCsMsg' 38
 		atPut msgDict 'allCRCsMsg' 39
+		atPut msgDict 'getTaskStatsMsg' 40
+		atPut msgDict 'taskStatsMsg' 41
+		atPut msgDict 'profileMsg' 42
+		atPut msgDict 'profileDataMsg' 43
+		atPut msgDict 'chunkBatchMsg' 44
+		atPut msgDict 'chunkBatchAckMsg' 45
 		atPut msgDict 'deleteFile' 200
 		atPut msgDict 'listFiles' 201
 		atPut msgDict 'fileInfo' 202
@@ -2065,6 +2284,11 @@ method errorString SmallRuntime errID {
 #define cannotUseWithBLE		50	// Cannot use this feature when board is connected to IDE via Bluetooth
 #define bad8BitBitmap			51	// Needs an 8-bit bitmap: a list containing the bitmap width and contents (a byte array)
 #define badColorPalette			52	// Needs a color palette: a list of positive 24-bit integers representing RGB values
+#define encoderNotStarted		53	// Encoder not started; pin may not support interrupts
+#define tooManyTasks			54	// Too many tasks; no free task entries
+#define packedArrayStoreError	55	// An Int16Array can only store integer values between -32768 and 32767
+#define needsVector				56	// Needs a byte array or packed array
+#define vectorTypeMismatch		57	// Both vectors must have the same item type
 '
 	for line (lines defsFromHeaderFile) {
 		words = (words line)
@@ -2287,6 +2511,13 @@ method handleMessage SmallRuntime msg {
 		crcReceived this (byteAt msg 3) (copyFromTo (toArray msg) 6)
 	} (op == (msgNameToID this 'allCRCsMsg')) {
 		allCRCsReceived this (copyFromTo (toArray msg) 6)
+	} (op == (msgNameToID this 'taskStatsMsg')) {
+		taskStatsReceived this (copyFromTo (toArray msg) 6)
+	} (op == (msgNameToID this 'profileDataMsg')) {
+		profileDataReceived this (byteAt msg 3) (copyFromTo (toArray msg) 6)
+	} (op == (msgNameToID this 'chunkBatchAckMsg')) {
+		lastBatchAck = ((byteAt msg 6) | ((byteAt msg 7) << 8))
+		if (65535 == lastBatchAck) { lastBatchAck = -1 }
 	} (op == (msgNameToID this 'pingMsg')) {
 		lastPingRecvMSecs = (msecsSinceStart)
 	} (op == (msgNameToID this 'broadcastMsg')) {
@@ -0,0 +1,506 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2026 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// benchmark.c - Headless interpreter benchmarks for the Linux VM
+//
+// Build with buildBenchmark.sh. The benchmark runs without a pseudo terminal or IDE.
+//
+// Usage: vm_benchmark [-n iterations] [codeFile]
+//
+// With no code file, run the built-in workloads and the code store compaction benchmark.
+// Otherwise, load the given code file
+// (e.g. the "ublockscode" file written by the Linux VM after downloading a project from
+// the IDE) and benchmark each of its "when started" scripts. Those scripts must terminate.
+//
+// Each workload is run once with the profiler on to count opcode dispatches, allocations,
+// and garbage collections, then run the given number of times (default 10) with the
+// profiler off to measure its run time. Since workloads are deterministic, the counts are
+// the same for every run. The built-in workloads store a result in global variable 0,
+// which is checked after every run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "interp.h"
+#include "persist.h"
+
+#ifndef PROFILER
+	#error "benchmark.c must be compiled with -D PROFILER"
+#endif
+
+extern char *codeFileName;
+
+// Selected Opcodes (see MicroBlocksCompiler.gp for complete set)
+
+#define pushImmediate 2
+#define pushLargeInteger 3
+#define pushLiteral 5
+#define storeGlobal 7
+#define initLocals 9
+#define pushLocal 10
+#define storeLocal 11
+#define pushArg 13
+#define jmp 22
+#define decrementAndJmp 26
+#define callFunction 34
+#define returnResult 35
+#define commandPrimitive 36
+#define reporterPrimitive 37
+#define add 50
+#define newList 80
+#define size 83
+#define updateLocal 104
+#define codeEnd 127
+
+// Chunk Builder
+//
+// A tiny assembler for the built-in workloads. It produces the same chunk format as the
+// IDE compiler: instructions, padded to an even number of 16-bit words, followed by the
+// literal strings.
+
+#define MAX_CODE_WORDS 200
+#define MAX_LITERALS 8
+
+typedef struct {
+	int16 code[MAX_CODE_WORDS];
+	int count;
+	int literalRefs[MAX_LITERALS]; // index of the word holding the offset to each literal
+	const char *literals[MAX_LITERALS];
+	int literalCount;
+} ChunkBuilder;
+
+static void emit(ChunkBuilder *b, int op, int arg) {
+	b->code[b->count++] = ((arg & 0xFF) << 8) | (op & 0x7F);
+}
+
+static void emitWord(ChunkBuilder *b, int word) {
+	b->code[b->count++] = word;
+}
+
+static void emitInt(ChunkBuilder *b, int n) {
+	int intObj = (n << 1) | 1;
+	if ((-64 <= n) && (n <= 63)) {
+		emit(b, pushImmediate, intObj);
+	} else { // must fit in 24 bits
+		emit(b, pushLargeInteger, intObj);
+		emitWord(b, intObj >> 8);
+	}
+}
+
+static void emitLiteralRef(ChunkBuilder *b, const char *s, int highBits) {
+	// Emit the second word of a pushLiteral or primitive call. The offset to the literal
+	// is filled in by finishChunk().
+
+	b->literalRefs[b->literalCount] = b->count;
+	b->literals[b->literalCount++] = s;
+	emitWord(b, highBits);
+}
+
+static void emitString(ChunkBuilder *b, const char *s) {
+	emit(b, pushLiteral, 0);
+	emitLiteralRef(b, s, 0);
+}
+
+static void emitPrim(ChunkBuilder *b, int isReporter, PrimitiveSetIndex setIndex, const char *primName, int argCount) {
+	emit(b, (isReporter ? reporterPrimitive : commandPrimitive), argCount);
+	emitLiteralRef(b, primName, setIndex << 10);
+}
+
+static void emitJumpTo(ChunkBuilder *b, int op, int target) {
+	int offset = target - (b->count + 1);
+	if ((offset != 0) && (-128 <= offset) && (offset <= 127)) {
+		emit(b, op, offset);
+	} else {
+		emit(b, op, 0); // extended jump; offset is in the next word
+		emitWord(b, target - (b->count + 1));
+	}
+}
+
+static int beginRepeat(ChunkBuilder *b, int count) {
+	// Begin a "repeat count" loop and return the index of the first instruction of its body.
+
+	emitInt(b, count);
+	emit(b, jmp, 0); // jump to the loop test; offset is set by endRepeat()
+	emitWord(b, 0);
+	return b->count;
+}
+
+static void endRepeat(ChunkBuilder *b, int bodyStart) {
+	b->code[bodyStart - 1] = b->count - bodyStart;
+	emitJumpTo(b, decrementAndJmp, bodyStart);
+}
+
+static int finishChunk(ChunkBuilder *b, int chunkType, uint8 *buf) {
+	// Append codeEnd and the literals, then store the chunk type and code in buf.
+	// Return the number of bytes stored.
+
+	emit(b, codeEnd, 0);
+	if (b->count & 1) emit(b, codeEnd, 0); // literals must start on a 32-bit word boundary
+	for (int i = 0; i < b->literalCount; i++) {
+		const char *s = b->literals[i];
+		int wordCount = (strlen(s) + 4) / 4;
+		b->code[b->literalRefs[i]] |= b->count - b->literalRefs[i];
+		uint32 header = HEADER(StringType, wordCount);
+		memset(&b->code[b->count], 0, 4 * (wordCount + 1));
+		memcpy(&b->code[b->count], &header, 4);
+		memcpy(&b->code[b->count + 2], s, strlen(s));
+		b->count += 2 * (wordCount + 1);
+	}
+	buf[0] = chunkType;
+	memcpy(&buf[1], b->code, 2 * b->count);
+	return 1 + (2 * b->count);
+}
+
+static void storeChunk(int chunkIndex, int chunkType, ChunkBuilder *b) {
+	uint8 buf[1 + (2 * MAX_CODE_WORDS)];
+	int byteCount = finishChunk(b, chunkType, buf);
+	storeCodeChunk(chunkIndex, byteCount, buf);
+}
+
+// Built-in Workloads
+
+#define FUNCTION_CHUNK 20
+
+typedef struct {
+	const char *name;
+	int chunkIndex;
+	int expected; // expected value of global variable 0 after each run
+} Workload;
+
+static Workload workloads[] = {
+	{"int loop", 0, 1000000},
+	{"int loop (fused)", 1, 1000000},
+	{"list append/delete", 2, 250},
+	{"string join/split", 3, 3},
+	{"JSON get", 4, 42},
+	{"function calls", 5, 100000},
+	{"vector dot product", 6, 9000},
+	{"vector moving avg", 7, 3000},
+};
+
+#define WORKLOAD_COUNT ((int) (sizeof(workloads) / sizeof(Workload)))
+
+static void storeIntLoop(int chunkIndex, int fused) {
+	// i = 0; repeat 1000000 { i = i + 1 }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	int body = beginRepeat(&b, 1000000);
+		emit(&b, (fused ? updateLocal : pushLocal), 0);
+		emitInt(&b, 1);
+		emit(&b, add, 2);
+		emit(&b, storeLocal, 0);
+	endRepeat(&b, body);
+	emit(&b, pushLocal, 0);
+	emit(&b, storeGlobal, 0);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeListWorkload(int chunkIndex) {
+	// repeat 100 { list = (newList); repeat 500 { addLast 1 list }; repeat 250 { delete 1 list } }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	int outer = beginRepeat(&b, 100);
+		emit(&b, newList, 0);
+		emit(&b, storeLocal, 0);
+		int appendLoop = beginRepeat(&b, 500);
+			emitInt(&b, 1);
+			emit(&b, pushLocal, 0);
+			emitPrim(&b, false, DataPrims, "addLast", 2);
+		endRepeat(&b, appendLoop);
+		int deleteLoop = beginRepeat(&b, 250);
+			emitInt(&b, 1);
+			emit(&b, pushLocal, 0);
+			emitPrim(&b, false, DataPrims, "delete", 2);
+		endRepeat(&b, deleteLoop);
+	endRepeat(&b, outer);
+	emit(&b, pushLocal, 0);
+	emit(&b, size, 1);
+	emit(&b, storeGlobal, 0);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeStringWorkload(int chunkIndex) {
+	// repeat 20000 { s = (join 'abc,def' ',ghi'); result = (size (split s ',')) }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	int body = beginRepeat(&b, 20000);
+		emitString(&b, "abc,def");
+		emitString(&b, ",ghi");
+		emitPrim(&b, true, DataPrims, "join", 2);
+		emit(&b, storeLocal, 0);
+		emit(&b, pushLocal, 0);
+		emitString(&b, ",");
+		emitPrim(&b, true, DataPrims, "split", 2);
+		emit(&b, size, 1);
+		emit(&b, storeGlobal, 0);
+	endRepeat(&b, body);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeJSONWorkload(int chunkIndex) {
+	// repeat 20000 { result = (jsonGet json 'b.c') }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 0);
+	int body = beginRepeat(&b, 20000);
+		emitString(&b, "{\"a\": 1, \"b\": {\"d\": [1, 2, 3], \"c\": 42}, \"e\": \"text\"}");
+		emitString(&b, "b.c");
+		emitPrim(&b, true, MiscPrims, "jsonGet", 2);
+		emit(&b, storeGlobal, 0);
+	endRepeat(&b, body);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeFunctionWorkload(int chunkIndex) {
+	// increment n: return (n + 1)
+	// n = 0; repeat 100000 { n = (increment n) }
+
+	ChunkBuilder f = {0};
+	emit(&f, initLocals, 0);
+	emit(&f, pushArg, 0);
+	emitInt(&f, 1);
+	emit(&f, add, 2);
+	emit(&f, returnResult, 0);
+	storeChunk(FUNCTION_CHUNK, functionHat, &f);
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	int body = beginRepeat(&b, 100000);
+		emit(&b, pushLocal, 0);
+		emit(&b, callFunction, 0);
+		emitWord(&b, (FUNCTION_CHUNK << 8) | 1); // chunk index and arg count
+		emit(&b, storeLocal, 0);
+	endRepeat(&b, body);
+	emit(&b, pushLocal, 0);
+	emit(&b, storeGlobal, 0);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void emitVectorOfThrees(ChunkBuilder *b) {
+	// v = (newPackedArray 1000 'int16'); vectorAdd 3 v
+
+	emitInt(b, 1000);
+	emitString(b, "int16");
+	emitPrim(b, true, DataPrims, "newPackedArray", 2);
+	emit(b, storeLocal, 0);
+	emitInt(b, 3);
+	emit(b, pushLocal, 0);
+	emitPrim(b, false, DataPrims, "vectorAdd", 2);
+}
+
+static void storeVectorDotWorkload(int chunkIndex) {
+	// v = 1000 threes; repeat 10000 { result = (vectorDot v v) }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	emitVectorOfThrees(&b);
+	int body = beginRepeat(&b, 10000);
+		emit(&b, pushLocal, 0);
+		emit(&b, pushLocal, 0);
+		emitPrim(&b, true, DataPrims, "vectorDot", 2);
+		emit(&b, storeGlobal, 0);
+	endRepeat(&b, body);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeMovingAverageWorkload(int chunkIndex) {
+	// v = 1000 threes; repeat 1000 { result = (vectorSum (vectorMovingAverage v 8)) }
+
+	ChunkBuilder b = {0};
+	emit(&b, initLocals, 1);
+	emitVectorOfThrees(&b);
+	int body = beginRepeat(&b, 1000);
+		emit(&b, pushLocal, 0);
+		emitInt(&b, 8);
+		emitPrim(&b, true, DataPrims, "vectorMovingAverage", 2);
+		emitPrim(&b, true, DataPrims, "vectorSum", 1);
+		emit(&b, storeGlobal, 0);
+	endRepeat(&b, body);
+	storeChunk(chunkIndex, startHat, &b);
+}
+
+static void storeBuiltInWorkloads() {
+	storeIntLoop(0, false);
+	storeIntLoop(1, true);
+	storeListWorkload(2);
+	storeStringWorkload(3);
+	storeJSONWorkload(4);
+	storeFunctionWorkload(5);
+	storeVectorDotWorkload(6);
+	storeMovingAverageWorkload(7);
+}
+
+// Measurement
+
+#define MAX_ITERATIONS 1000
+
+static int compareTimes(const void *a, const void *b) {
+	uint32 t1 = *(uint32 *) a;
+	uint32 t2 = *(uint32 *) b;
+	return (t1 > t2) - (t1 < t2);
+}
+
+static uint32 runOnce(int chunkIndex) {
+	// Run the given chunk to completion and return its run time in microseconds.
+
+	vars[0] = zeroObj;
+	uint32 startUSecs = microsecs();
+	startTaskForChunk(chunkIndex);
+	runTasksUntilDone();
+	return microsecs() - startUSecs;
+}
+
+static int benchmark(const char *name, int chunkIndex, int checkResult, int expected, int iterations) {
+	// Benchmark the given chunk and print the results. Return false if a result check fails.
+
+	static uint32 times[MAX_ITERATIONS];
+	int ok = true;
+
+	// count opcode dispatches, allocations, and garbage collections with the profiler on
+	processProfileMsg(1); // start profiling
+	runOnce(chunkIndex);
+	processProfileMsg(0); // stop profiling
+	uint32 dispatches = 0;
+	for (int i = 0; i < 128; i++) dispatches += profileOpCounts[i];
+	uint32 allocatedWords = profileAllocatedWords;
+	uint32 gcCount = profileGCCount;
+	uint32 gcUSecs = profileGCUSecs;
+
+	// measure run times with the profiler off
+	for (int i = 0; i < iterations; i++) {
+		times[i] = runOnce(chunkIndex);
+		if (checkResult && (evalInt(vars[0]) != expected)) ok = false;
+	}
+	qsort(times, iterations, sizeof(uint32), compareTimes);
+	uint32 p50 = times[(iterations - 1) / 2];
+	uint32 p99 = times[(99 * (iterations - 1)) / 100];
+	double secs = (p50 > 0) ? (p50 / 1000000.0) : 0.000001;
+
+	printf("%-20s %9.3f %9.3f %12.0f %6u %9.3f %12.0f  %s\n",
+		name, p50 / 1000.0, p99 / 1000.0, dispatches / secs,
+		gcCount, gcUSecs / 1000.0, allocatedWords / secs,
+		(checkResult ? (ok ? "ok" : "WRONG RESULT") : ""));
+	return ok;
+}
+
+static void printHeader(int iterations) {
+	printf("%d timed runs per workload; times are p50 and p99 run times\n\n", iterations);
+	printf("%-20s %9s %9s %12s %6s %9s %12s\n",
+		"workload", "p50 ms", "p99 ms", "ops/sec", "GCs", "GC ms", "words/sec");
+}
+
+// Code Store Compaction
+
+#define EDIT_FIRST_CHUNK 30
+#define EDIT_CHUNKS 100
+#define EDITS_PER_ROUND 500
+
+static void storeEditedChunk(int chunkIndex, int instructionCount) {
+	ChunkBuilder b = {0};
+	for (int i = 0; i < instructionCount; i++) emitInt(&b, i & 63);
+	storeChunk(chunkIndex, functionHat, &b);
+}
+
+static int benchmarkCompaction(int iterations) {
+	// Replay an edit log through the RAM code store. Each round stores EDITS_PER_ROUND chunk
+	// records, most of which supersede earlier records, plus a variable name record for every
+	// tenth edit, then compacts the code store. Print the p50 and p99 compaction times.
+	// Return false if a chunk is lost.
+
+	static uint32 times[MAX_ITERATIONS];
+	char name[16];
+	int ok = true;
+
+	for (int i = 0; i < iterations; i++) {
+		for (int j = 0; j < EDITS_PER_ROUND; j++) {
+			int id = (7 * j) % EDIT_CHUNKS;
+			if (0 == (j % 10)) {
+				snprintf(name, sizeof(name), "var%d", j);
+				appendPersistentRecord(varName, id, 0, strlen(name) + 1, (uint8 *) name);
+			}
+			storeEditedChunk(EDIT_FIRST_CHUNK + id, 8 + (j % 16));
+		}
+		uint32 startUSecs = microsecs();
+		compactCodeStore();
+		times[i] = microsecs() - startUSecs;
+		for (int id = 0; id < EDIT_CHUNKS; id++) {
+			if (!chunks[EDIT_FIRST_CHUNK + id].code) ok = false;
+		}
+	}
+	qsort(times, iterations, sizeof(uint32), compareTimes);
+	printf("\ncode store compaction (%d chunk edits per round)\n", EDITS_PER_ROUND);
+	printf("%-20s %9.3f %9.3f %12s %6s %9s %12s  %s\n",
+		"compact", times[(iterations - 1) / 2] / 1000.0, times[(99 * (iterations - 1)) / 100] / 1000.0,
+		"", "", "", "", (ok ? "ok" : "LOST CHUNKS"));
+	return ok;
+}
+
+// Stubs for the SDL-based IO and TFT primitives, which are not part of the headless build
+
+void addIOPrims() {}
+void addTFTPrims() {}
+OBJ primButtonA(OBJ *args) { return falseObj; }
+OBJ primButtonB(OBJ *args) { return falseObj; }
+void primSetUserLED(OBJ *args) {}
+void stopTone() {}
+void tftClear() {}
+void tftSetHugePixel(int x, int y, int state) {}
+void tftSetHugePixelBits(int bits) {}
+void updateMicrobitDisplay() {}
+
+// Entry Point
+
+int benchmarkMain(int argc, char *argv[]) {
+	int iterations = 10;
+	char *fileName = NULL;
+	for (int i = 1; i < argc; i++) {
+		if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc)) {
+			iterations = atoi(argv[++i]);
+		} else {
+			fileName = argv[i];
+		}
+	}
+	if (iterations < 1) iterations = 1;
+	if (iterations > MAX_ITERATIONS) iterations = MAX_ITERATIONS;
+
+	if (fileName) {
+		codeFileName = fileName;
+	} else {
+		codeFileName = "/tmp/ublocks_benchmark_code";
+		remove(codeFileName); // start with an empty code store
+	}
+	memInit();
+	primsInit();
+	restoreScripts();
+
+	int failures = 0;
+	if (fileName) {
+		printf("Benchmarking the 'when started' scripts in %s\n", fileName);
+		printHeader(iterations);
+		char name[32];
+		for (int i = 0; i < MAX_CHUNKS; i++) {
+			if (startHat == chunks[i].chunkType) {
+				snprintf(name, sizeof(name), "chunk %d", i);
+				benchmark(name, i, false, 0, iterations);
+			}
+		}
+	} else {
+		storeBuiltInWorkloads();
+		printHeader(iterations);
+		for (int i = 0; i < WORKLOAD_COUNT; i++) {
+			Workload *w = &workloads[i];
+			if (!benchmark(w->name, w->chunkIndex, true, w->expected, iterations)) failures++;
+		}
+		if (!benchmarkCompaction(iterations)) failures++;
+		remove(codeFileName);
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Build the headless interpreter benchmark for generic GNU/Linux (see benchmark.c)
+# Run it with: ./vm_benchmark_i386 [-n iterations] [codeFile]
+#
+# The benchmark does not use SDL, so it omits the IO and TFT primitives and needs only
+# the 32-bit C library (e.g. sudo apt install gcc-multilib).
+
+gcc -m32 -std=c99 -Wall -Wno-unused-variable -Wno-unused-result -O3 \
+	-D GNUBLOCKS \
+	-D BENCHMARK \
+	-D PROFILER \
+	-I ../vm \
+	linux.c benchmark.c ../vm/*.c \
+	linuxFilePrims.c linuxNetPrims.c linuxOutputPrims.c linuxSensorPrims.c \
+	-lm \
+	-o vm_benchmark_i386
@@ -15,6 +15,7 @@
 #define _DEFAULT_SOURCE
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h> // still needed?
 #include <sys/ioctl.h>
@@ -60,6 +61,18 @@ uint32 millisecs() {
 	return (1000 * (now.tv_sec - startSecs)) + (now.tv_usec / 1000);
 }
 
+uint64 totalMicrosecs() {
+	// Returns a 64-bit integer containing microseconds since start.
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	uint64 secs = now.tv_sec - startSecs;
+	return (1000000 * secs) + now.tv_usec;
+}
+
+void handleMicosecondClockWrap() { } // not needed; totalMicrosecs() uses gettimeofday()
+
 #ifndef ARDUINO_RASPBERRY_PI
 void delay(int ms) {
 	clock_t start = millisecs();
@@ -70,12 +83,18 @@ void delay(int ms) {
 
 // Communication/System Functions
 
-static int pty; // pseudo terminal used for communication with the IDE
+static int pty = -1; // pseudo terminal used for communication with the IDE (-1 when headless)
 
 int serialConnected() {
 	return pty > -1;
 }
 
+int ideConnected() {
+	return serialConnected();
+}
+
+char BLE_ThreeLetterID[4] = "";
+
 static void makePtyFile() {
 	FILE *file = fopen("/tmp/ublocksptyname", "w");
 	if (file) {
@@ -123,6 +142,27 @@ int sendByte(char aByte) {
 	return write(pty, &aByte, 1);
 }
 
+int sendBytes(uint8 *buf, int start, int end) {
+	// Send bytes buf[start] through buf[end - 1] and return the number of bytes sent.
+
+	if (pty < 0) return end - start; // headless; discard output
+	int byteCount = write(pty, &buf[start], end - start);
+	return (byteCount < 0) ? 0 : byteCount;
+}
+
+void waitForInput(int usecs) {
+	// Wait until input from the IDE is available or the given number of usecs has elapsed.
+
+	if (usecs < 1000) { // poll() timeouts are in milliseconds
+		usleep(usecs);
+		return;
+	}
+	struct pollfd fds = { pty, POLLIN, 0 };
+	if ((poll(&fds, 1, usecs / 1000) > 0) && (fds.revents & POLLHUP)) {
+		usleep(usecs); // IDE not connected; poll() returns immediately
+	}
+}
+
 // System Functions
 
 const char * boardType() {
@@ -206,9 +246,15 @@ void primDigitalSet(int pinNum, int flag) { };
 
 // Stubs for other functions not used on Linux
 
-void addSerialPrims() {}
+void addBLEPrims() {}
+void addCameraPrims() {}
+void addEncoderPrims() {}
 void addHIDPrims() {}
 void addOneWirePrims() {}
+void addRadioPrims() {}
+void addSerialPrims() {}
+void BLE_setEnabled(int enableFlag) {}
+void resetRadio() {}
 void processFileMessage(int msgType, int dataSize, char *data) {}
 void resetServos() {}
 void stopPWM() {}
@@ -221,10 +267,15 @@ void stopServos() {}
 char *codeFileName = "ublockscode";
 FILE *codeFile;
 
-void initCodeFile(uint8 *flash, int flashByteCount) {
+int initCodeFile(uint8 *flash, int flashByteCount) {
 	codeFile = fopen(codeFileName, "ab+");
 	fseek(codeFile, 0 , SEEK_END);
 	long fileSize = ftell(codeFile);
+	if (0 == fileSize) { // new code file; start it with the half-space header
+		clearCodeFile(0);
+		fflush(codeFile);
+		fileSize = 4;
+	}
 
 	// read code file into simulated Flash:
 	fseek(codeFile, 0L, SEEK_SET);
@@ -232,16 +283,25 @@ void initCodeFile(uint8 *flash, int flashByteCount) {
 	if (bytesRead != fileSize) {
 		outputString("initCodeFile did not read entire file");
 	}
+	return bytesRead;
 }
 
+static int codeFileDirty = false; // true if the file has changed since the last sync
+
 void writeCodeFile(uint8 *code, int byteCount) {
-	fwrite(code, 1, byteCount, codeFile);
-	fflush(codeFile);
+	fwrite(code, 1, byteCount, codeFile); // buffered by stdio until the next sync
+	codeFileDirty = true;
 }
 
 void writeCodeFileWord(int word) {
-	fwrite(&word, 1, 4, codeFile);
+	writeCodeFile((uint8 *) &word, 4);
+}
+
+void syncCodeFile() {
+	if (!codeFileDirty) return;
 	fflush(codeFile);
+	fsync(fileno(codeFile));
+	codeFileDirty = false;
 }
 
 void clearCodeFile(int ignore) {
@@ -249,7 +309,7 @@ void clearCodeFile(int ignore) {
 	remove(codeFileName);
 	codeFile = fopen(codeFileName, "ab+");
 	uint32 cycleCount = ('S' << 24) | 1; // Header record, version 1
-	fwrite((uint8 *) &cycleCount, 1, 4, codeFile);
+	writeCodeFile((uint8 *) &cycleCount, 4);
 }
 
 // Debug
@@ -261,7 +321,17 @@ void segfault() {
 
 // Linux Main
 
+#ifdef BENCHMARK
+int benchmarkMain(int argc, char *argv[]);
+#endif
+
 int main(int argc, char *argv[]) {
+#ifdef BENCHMARK
+	// headless interpreter benchmarks (see benchmark.c); no pseudo terminal
+	initTimers();
+	return benchmarkMain(argc, argv);
+#endif
+
 	codeFileName = "ublockscode"; // to do: allow code file name from command line
 
 	if (argc > 1) {
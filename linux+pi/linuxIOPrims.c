@@ -119,5 +119,5 @@ static PrimEntry entries[] = {
 };
 
 void addIOPrims() {
-	addPrimitiveSet("io", sizeof(entries) / sizeof(PrimEntry), entries);
+	addPrimitiveSet(IOPrims, "io", sizeof(entries) / sizeof(PrimEntry), entries);
 }
@@ -160,5 +160,5 @@ static PrimEntry entries[] = {
 };
 
 void addSensorPrims() {
-	addPrimitiveSet("sensors", sizeof(entries) / sizeof(PrimEntry), entries);
+	addPrimitiveSet(SensorPrims, "sensors", sizeof(entries) / sizeof(PrimEntry), entries);
 }
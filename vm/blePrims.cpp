@@ -767,11 +767,14 @@ static OBJ primEspNowLastEvent(int argCount, OBJ *args) {
 	delay(10);
 
 	if (hasEspNowMessage) {
-		OBJ event = newObj(ListType, 2, zeroObj);
-		FIELD(event, 0) = int2obj(1); //list size
-		FIELD(event, 1) = newStringFromBytes(receiveBuffer, strlen(receiveBuffer));
+		tempGCRoot = newObj(ListType, 2, zeroObj); // use tempGCRoot in case of GC
+		if (!tempGCRoot) return falseObj; // allocation failed
+		FIELD(tempGCRoot, 0) = int2obj(1); //list size
+		OBJ msg = newStringFromBytes(receiveBuffer, strlen(receiveBuffer));
+		WRITE_BARRIER(tempGCRoot, msg);
+		FIELD(tempGCRoot, 1) = msg;
 		hasEspNowMessage = false;
-		return event;
+		return tempGCRoot;
 	} else {
 		return falseObj;
 	}
@@ -20,6 +20,7 @@
 static int stringSize(OBJ obj) {
 	int wordCount = objWords(obj);
 	if (!wordCount) return 0; // empty string
+	if (IS_STRING_BUILDER(obj)) return stringBuilderLength(obj);
 	char *s = (char *) &FIELD(obj, 0);
 	int byteCount = 4 * (wordCount - 1);
 	for (int i = 0; i < 4; i++) {
@@ -141,6 +142,7 @@ OBJ primFillList(int argCount, OBJ *args) {
 	if (IS_TYPE(obj, ListType)) {
 		int count = obj2int(FIELD(obj, 0));
 		if (count >= WORDS(obj))count = WORDS(obj) - 1;
+		WRITE_BARRIER(obj, value);
 		for (int i = 0; i < count; i++) FIELD(obj, i + 1) = value;
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		if (!isInt(value)) return fail(byteArrayStoreError);
@@ -149,6 +151,12 @@ OBJ primFillList(int argCount, OBJ *args) {
 		uint8 *dst = (uint8 *) &FIELD(obj, 0);
 		uint8 *end = dst + (4 * WORDS(obj));
 		while (dst < end) *dst++ = byteValue;
+	} else if (IS_PACKED_ARRAY(obj)) {
+		if (!isInt(value)) return fail(needsIntegerError);
+		int count = packedArrayCount(obj);
+		for (int i = 0; i < count; i++) {
+			if (!packedArrayAtPut(obj, i, obj2int(value))) return fail(packedArrayStoreError);
+		}
 	} else {
 		fail(needsListError);
 	}
@@ -166,6 +174,8 @@ OBJ primAt(int argCount, OBJ *args) {
 		count = stringSize(obj);
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		count = BYTES(obj);
+	} else if (IS_PACKED_ARRAY(obj)) {
+		count = packedArrayCount(obj);
 	}
 
 	OBJ arg0 = args[0];
@@ -202,6 +212,8 @@ OBJ primAt(int argCount, OBJ *args) {
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		uint8 *bytes = (uint8 *) &FIELD(obj, 0);
 		return int2obj(bytes[i - 1]);
+	} else if (IS_PACKED_ARRAY(obj)) {
+		return int2obj(packedArrayAt(obj, i - 1));
 	}
 	return fail(needsListError);
 }
@@ -220,12 +232,16 @@ OBJ primAtPut(int argCount, OBJ *args) {
 		if (!isInt(value)) return fail(byteArrayStoreError);
 		byteValue = obj2int(value);
 		if (byteValue > 255) return fail(byteArrayStoreError);
+	} else if (IS_PACKED_ARRAY(obj)) {
+		count = packedArrayCount(obj);
+		if (!isInt(value)) return fail(needsIntegerError);
 	} else {
 		return fail(needsListError);
 	}
 
 	if (matches("all", args[0])) {
 		if (IS_TYPE(obj, ListType)) {
+			WRITE_BARRIER(obj, value);
 			for (i = 1; i <= count; i++) {
 				FIELD(obj, i) = value;
 			}
@@ -233,6 +249,10 @@ OBJ primAtPut(int argCount, OBJ *args) {
 			for (i = 1; i <= count; i++) {
 				((uint8 *) &FIELD(obj, 0))[i - 1] = byteValue;
 			}
+		} else if (IS_PACKED_ARRAY(obj)) {
+			for (i = 0; i < count; i++) {
+				if (!packedArrayAtPut(obj, i, obj2int(value))) return fail(packedArrayStoreError);
+			}
 		}
 		return falseObj;
 	}
@@ -252,9 +272,12 @@ OBJ primAtPut(int argCount, OBJ *args) {
 	}
 
 	if (IS_TYPE(obj, ListType)) {
+		WRITE_BARRIER(obj, value);
 		FIELD(obj, i) = value;
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		((uint8 *) &FIELD(obj, 0))[i - 1] = byteValue;
+	} else if (IS_PACKED_ARRAY(obj)) {
+		if (!packedArrayAtPut(obj, i - 1, obj2int(value))) return fail(packedArrayStoreError);
 	}
 	return falseObj;
 }
@@ -268,6 +291,8 @@ OBJ primLength(int argCount, OBJ *args) {
 		return int2obj(BYTES(obj));
 	} else if (IS_TYPE(obj, StringType)) {
 		return int2obj(countUTF8(obj2str(obj)));
+	} else if (IS_PACKED_ARRAY(obj)) {
+		return int2obj(packedArrayCount(obj));
 	}
 	return zeroObj;
 }
@@ -318,20 +343,38 @@ OBJ primListAddLast(int argCount, OBJ *args) {
 
 	int count = obj2int(FIELD(list, 0));
 	if (count >= (WORDS(list) - 1)) { // no more capacity; try to grow
-		int growBy = count / 3;
-		if (growBy < 4) growBy = 3;
-		if (growBy > 100) growBy = 100;
+		// grow by half so that the cost of moving the list is amortized over many appends,
+		// but don't take more than a quarter of the remaining memory
+		int growBy = count / 2;
+		if (growBy < 4) growBy = 4;
+		int maxGrowBy = wordsFree() / 4;
+		if (growBy > maxGrowBy) growBy = (maxGrowBy > 1) ? maxGrowBy : 1;
 
 		list = resizeObj(list, WORDS(list) + growBy);
 	}
 	if (count < (WORDS(list) - 1)) { // append item if there's room
 		count++;
+		WRITE_BARRIER(list, args[0]);
 		FIELD(list, count) = args[0];
 		FIELD(list, 0) = int2obj(count);
 	}
 	return falseObj;
 }
 
+OBJ primListEnsureCapacity(int argCount, OBJ *args) {
+	// Grow the given List, if necessary, so that it can hold the given number of items
+	// without growing again. Useful for preallocating a list that will be filled by addLast.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ list = args[0];
+	if (!IS_TYPE(list, ListType)) return fail(needsListError);
+	if (!isInt(args[1])) return fail(needsIntegerError);
+
+	int capacity = obj2int(args[1]);
+	if (capacity > (WORDS(list) - 1)) resizeObj(list, capacity + 1);
+	return falseObj;
+}
+
 OBJ primListDelete(int argCount, OBJ *args) {
 	// Delete item(s) from the given List.
 
@@ -402,6 +445,9 @@ OBJ primCopyFromTo(int argCount, OBJ *args) {
 		int endIndex = (argCount > 2) ? obj2int(args[2]) : srcLen;
 		if (endIndex > srcLen) endIndex = srcLen;
 		if (startIndex > endIndex) return newString(0);
+		if ((1 == startIndex) && (endIndex == srcLen) && !IS_STRING_BUILDER(src)) {
+			return src; // whole string; no need to copy
+		}
 
 		char *start = obj2str(src);
 		for (int i = 1; i < startIndex; i++) start = nextUTF8(start);
@@ -434,6 +480,72 @@ OBJ primCopyFromTo(int argCount, OBJ *args) {
 	return fail(needsIndexable);
 }
 
+static OBJ appendToStringBuilder(int argCount, OBJ *args) {
+	// Append the string, integer, boolean, or byte array arguments following the string
+	// builder args[0] to it and return it. If the builder is too small, grow it to at least
+	// twice its capacity with resizeObj(), which updates all references to it, so the builder
+	// is always modified in place.
+
+	char buf[50];
+	int count, appendCount = 0;
+	for (int i = 1; i < argCount; i++) {
+		OBJ arg = args[i];
+		if (IS_TYPE(arg, StringType)) {
+			appendCount += stringSize(arg);
+		} else if (isInt(arg) || isBoolean(arg)) {
+			printIntegerOrBooleanInto(arg, buf);
+			appendCount += strlen(buf);
+		} else if (IS_TYPE(arg, ByteArrayType)) {
+			appendCount += BYTES(arg);
+		} else {
+			return fail(joinArgsNotSameType);
+		}
+	}
+
+	OBJ builder = args[0];
+	int length = stringBuilderLength(builder);
+	int capacity = stringBuilderCapacity(builder);
+	if ((length + appendCount) > capacity) { // grow
+		capacity *= 2;
+		if (capacity < (length + appendCount)) capacity = length + appendCount;
+		int wordCount = (((capacity + 1) + 3) / 4) + 1; // room for terminator and length word
+		builder = resizeObj(builder, wordCount);
+		if (WORDS(builder) < wordCount) return falseObj; // allocation failed (already reported)
+		*builder |= STRING_BUILDER_FLAG; // resizeObj() rewrites the header
+		setStringBuilderLength(builder, length); // the length word moves to the new last word
+	}
+
+	char *dst = obj2str(builder) + length;
+	for (int i = 1; i < argCount; i++) {
+		OBJ arg = args[i];
+		if (IS_TYPE(arg, StringType)) {
+			count = stringSize(arg);
+			memmove(dst, obj2str(arg), count); // arg may be the builder itself
+			dst += count;
+		} else if (isInt(arg) || isBoolean(arg)) {
+			printIntegerOrBooleanInto(arg, buf);
+			count = strlen(buf);
+			memcpy(dst, buf, count);
+			dst += count;
+		} else if (IS_TYPE(arg, ByteArrayType)) {
+			count = BYTES(arg);
+			memcpy(dst, (char *) &FIELD(arg, 0), count);
+			dst += count;
+		}
+	}
+	*dst = 0; // null terminator
+	setStringBuilderLength(builder, length + appendCount);
+	return builder;
+}
+
+OBJ primNewStringBuilder(int argCount, OBJ *args) {
+	// Return an empty string builder. The optional argument is its initial capacity in bytes.
+
+	int capacity = ((argCount > 0) && isInt(args[0])) ? obj2int(args[0]) : 100;
+	if (capacity < 16) capacity = 16;
+	return newStringBuilder(capacity);
+}
+
 OBJ primJoin(int argCount, OBJ *args) {
 	if (argCount < 2) return fail(notEnoughArguments);
 	char buf[50];
@@ -480,20 +592,34 @@ OBJ primJoin(int argCount, OBJ *args) {
 			char *src = (char *) &FIELD(arg, 0);
 			for (int j = 0; j < byteCount; j++) *dst++ = src[j];
 		}
+	} else if (IS_STRING_BUILDER(arg1)) {
+		return appendToStringBuilder(argCount, args);
 	} else {
+		OBJ nonEmptyString = NULL; // the only non-empty argument, if it is a string
+		int nonEmptyCount = 0;
 		for (int i = 0; i < argCount; i++) {
 			arg = args[i];
 			if (IS_TYPE(arg, StringType)) {
-				resultCount += stringSize(arg);
+				count = stringSize(arg);
+				resultCount += count;
+				if (count > 0) {
+					nonEmptyString = arg;
+					nonEmptyCount++;
+				}
 			} else if (isInt(arg) || isBoolean(arg)) {
 				printIntegerOrBooleanInto(arg, buf);
 				resultCount += strlen(buf);
+				nonEmptyCount += 2; // never empty and not a string
 			} else if (IS_TYPE(arg, ByteArrayType)) {
 				resultCount += BYTES(arg);
+				if (BYTES(arg) > 0) nonEmptyCount += 2; // not a string
 			} else {
 				return fail(joinArgsNotSameType);
 			}
 		}
+		if ((1 == nonEmptyCount) && !IS_STRING_BUILDER(nonEmptyString)) {
+			return nonEmptyString; // other args are empty strings; no need to copy
+		}
 		result = newString(resultCount);
 		if (!result) return result; // allocation failed
 		char *dst = (char *) &FIELD(result, 0);
@@ -527,6 +653,10 @@ OBJ primSplit(int argCount, OBJ *args) {
 	char *delim = obj2str(args[1]);
 	int delimLen = strlen(delim);
 
+	// Note: Each allocation below may trigger a garbage collection that moves args[0] and
+	// args[1] (unless they are read-only strings), so substrings are tracked by their byte
+	// offset in args[0] and the string pointers are recomputed after each allocation.
+
 	// count substrings for result list
 	int resultCount = 0;
 	if (delimLen == 0) {
@@ -547,42 +677,43 @@ OBJ primSplit(int argCount, OBJ *args) {
 	FIELD(tempGCRoot, 0) = int2obj(resultCount);
 
 	// add substrings to the result list
+	int offset = 0; // byte offset of the next substring in args[0]
 	if (delimLen == 0) {
 		// return a list containing the characters of s
-		char *last = s;
-		char *next = nextUTF8(last);
 		for (int i = 0; i < resultCount; i++) {
 			// allocate string and save in list
-			int byteCount = next - last;
+			char *last = obj2str(args[0]) + offset;
+			int byteCount = nextUTF8(last) - last;
 			OBJ item = newStringFromBytes(last, byteCount);
-			if (!item) return falseObj; // allocation failed
+			if (!item) { tempGCRoot = NULL; return falseObj; } // allocation failed
+			WRITE_BARRIER(tempGCRoot, item);
 			FIELD(tempGCRoot, i + 1) = item;
-			last = next;
-			next = nextUTF8(last);
+			offset += byteCount;
 		}
 	} else {
-		if (1 == resultCount) { // no delimiters found; return unsplit source string
+		if ((1 == resultCount) && !IS_STRING_BUILDER(args[0])) { // no delimiters found; return unsplit source string
+			WRITE_BARRIER(tempGCRoot, args[0]);
 			FIELD(tempGCRoot, 1) = args[0];
-			return tempGCRoot;
+			OBJ result = tempGCRoot;
+			tempGCRoot = NULL;
+			return result;
 		}
 		int i = 1;
-		char *last = s;
-		char *next = strstr(last, delim);
-		while (next && (i <= resultCount)) {
-			int byteCount = next - last;
+		while (i <= resultCount) {
+			char *last = obj2str(args[0]) + offset;
+			char *next = strstr(last, obj2str(args[1]));
+			int byteCount = next ? (next - last) : (int) strlen(last); // last item ends at end of s
 			OBJ item = newStringFromBytes(last, byteCount);
-			if (!item) return falseObj; // allocation failed
-			FIELD(tempGCRoot, i++) = item;
-			last = next + delimLen;
-			next = strstr(last, delim);
-		}
-		if (i <= resultCount) { //
-			OBJ item = newStringFromBytes(last, strlen(last));
-			if (!item) return falseObj; // allocation failed
+			if (!item) { tempGCRoot = NULL; return falseObj; } // allocation failed
+			WRITE_BARRIER(tempGCRoot, item);
 			FIELD(tempGCRoot, i++) = item;
+			if (!next) break;
+			offset += byteCount + delimLen;
 		}
 	}
-	return tempGCRoot;
+	OBJ result = tempGCRoot;
+	tempGCRoot = NULL;
+	return result;
 }
 
 OBJ primJoinStrings(int argCount, OBJ *args) {
@@ -797,6 +928,49 @@ OBJ primNewByteArray(int argCount, OBJ *args) {
 	return result;
 }
 
+OBJ primNewPackedArray(int argCount, OBJ *args) {
+	// Return a new packed array. The first argument is either the item count or a list of
+	// integers to copy into it. The optional second argument is the item type: "int16",
+	// "int32" (the default), or "float32".
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	OBJ src = args[0];
+	int typeID = Int32ArrayType;
+	if ((argCount > 1) && IS_TYPE(args[1], StringType)) {
+		char *typeName = obj2str(args[1]);
+		if (strcmp(typeName, "int16") == 0) typeID = Int16ArrayType;
+		else if (strcmp(typeName, "int32") == 0) typeID = Int32ArrayType;
+		else if (strcmp(typeName, "float32") == 0) typeID = Float32ArrayType;
+		else return fail(unknownDatatype);
+	}
+
+	int count = 0;
+	if (isInt(src)) {
+		count = obj2int(src);
+		if (count < 0) count = 0;
+	} else if (IS_TYPE(src, ListType)) {
+		count = obj2int(FIELD(src, 0));
+		for (int i = 1; i <= count; i++) {
+			if (!isInt(FIELD(src, i))) return fail(needsListOfIntegers);
+		}
+	} else {
+		return fail(needsIntOrListOfInts);
+	}
+
+	tempGCRoot = src; // record src in case allocation triggers GC that moves it
+	OBJ result = newPackedArray(typeID, count);
+	src = tempGCRoot; // restore src
+	tempGCRoot = NULL;
+	if (!result) return result; // allocation failed
+
+	if (IS_TYPE(src, ListType)) {
+		for (int i = 0; i < count; i++) {
+			if (!packedArrayAtPut(result, i, obj2int(FIELD(src, i + 1)))) return fail(packedArrayStoreError);
+		}
+	}
+	return result;
+}
+
 OBJ primAsByteArray(int argCount, OBJ *args) {
 	if (argCount < 1) return fail(notEnoughArguments);
 	OBJ arg = args[0];
@@ -842,9 +1016,410 @@ OBJ primAsByteArray(int argCount, OBJ *args) {
 }
 
 OBJ primFreeMemory(int argCount, OBJ *args) {
+	// Return the number of free words. With an optional argument of "minorGCs" or "majorGCs",
+	// return the number of minor or full garbage collections since the VM was started.
+
+	if (argCount > 0) {
+		if (matches("minorGCs", args[0])) return int2obj(minorGCCount);
+		if (matches("majorGCs", args[0])) return int2obj(majorGCCount);
+	}
 	return int2obj(wordsFree());
 }
 
+OBJ primHeapStats(int argCount, OBJ *args) {
+	// Return a list of heap statistics:
+	//	ByteArray count, ByteArray words, String count, String words,
+	//	Array count, Array words, List count, List words,
+	//	free words, largest free chunk (words), fragmentation (percent),
+	//	garbage collection count, total garbage collection time (msecs)
+
+	HeapStats stats;
+	getHeapStats(&stats); // before allocating the result so it is not counted
+
+	OBJ result = newObj(ListType, 14, zeroObj);
+	if (!result) return result; // allocation failed
+
+	const int typeIDs[] = {ByteArrayType, StringType, ArrayType, ListType};
+	int i = 1;
+	for (int j = 0; j < 4; j++) {
+		FIELD(result, i++) = int2obj(stats.objectCounts[typeIDs[j]]);
+		FIELD(result, i++) = int2obj(stats.objectWords[typeIDs[j]]);
+	}
+	FIELD(result, i++) = int2obj(stats.freeWords);
+	FIELD(result, i++) = int2obj(stats.largestFreeChunk);
+	FIELD(result, i++) = int2obj(stats.fragmentation);
+	FIELD(result, i++) = int2obj(stats.gcCount);
+	FIELD(result, i++) = int2obj(stats.gcMSecs);
+	FIELD(result, 0) = int2obj(i - 1);
+	return result;
+}
+
+// Vector Primitives
+//
+// These primitives operate on all the items of a vector (a ByteArray or packed array) in a
+// single call, avoiding the per-item cost of a script loop. Elementwise operations modify
+// the vector in place and saturate their results to the range of its item type. Each kernel
+// is expanded once per item type by FOR_EACH_ITEM_TYPE(). On processors with the ARM DSP
+// extension (e.g. Cortex-M4), Int16Array kernels process two items per instruction.
+
+#if defined(__ARM_FEATURE_DSP)
+	#include <arm_acle.h>
+#endif
+
+typedef long long int64;
+
+#define MAX_OBJ_INT 0x3FFFFFFF
+#define MIN_OBJ_INT (-0x40000000)
+
+#define ITEMS(obj, T) ((T *) &FIELD(obj, 0))
+
+// Round x, a value of type ACC, to the nearest integer. (ACC) 0.5 is zero if ACC is an integer type.
+#define ROUNDED(x, ACC) clampToInt((int64) (((x) < 0) ? ((x) - (ACC) 0.5) : ((x) + (ACC) 0.5)))
+
+#define FOR_EACH_ITEM_TYPE(obj, KERNEL) \
+	switch (TYPE(obj)) { \
+	case ByteArrayType: KERNEL(uint8, int64, saturateUInt8); break; \
+	case Int16ArrayType: KERNEL(int16, int64, saturateInt16); break; \
+	case Int32ArrayType: KERNEL(int, int64, clampToInt); break; \
+	case Float32ArrayType: KERNEL(float, float, (float)); break; \
+	}
+
+static inline int clampToInt(int64 n) {
+	if (n > MAX_OBJ_INT) return MAX_OBJ_INT;
+	if (n < MIN_OBJ_INT) return MIN_OBJ_INT;
+	return (int) n;
+}
+
+static inline uint8 saturateUInt8(int64 n) { return (n < 0) ? 0 : ((n > 255) ? 255 : n); }
+static inline int16 saturateInt16(int64 n) { return (n < -32768) ? -32768 : ((n > 32767) ? 32767 : n); }
+
+static inline int isVector(OBJ obj) {
+	return IS_TYPE(obj, ByteArrayType) || IS_PACKED_ARRAY(obj);
+}
+
+static inline int vectorCount(OBJ obj) {
+	return IS_TYPE(obj, ByteArrayType) ? BYTES(obj) : packedArrayCount(obj);
+}
+
+static inline int vectorAt(OBJ obj, int i) {
+	// Return the ith (zero-based) item of the given vector.
+
+	return IS_TYPE(obj, ByteArrayType) ? ITEMS(obj, uint8)[i] : packedArrayAt(obj, i);
+}
+
+#if defined(__ARM_FEATURE_DSP)
+
+static int64 int16DotDSP(int16 *a, int16 *b, int count) {
+	// Return the dot product of two Int16Arrays using dual 16-bit multiply-accumulates.
+
+	int64 sum = 0;
+	uint32 *pairsA = (uint32 *) a;
+	uint32 *pairsB = (uint32 *) b;
+	int pairCount = count / 2;
+	for (int i = 0; i < pairCount; i++) sum = __smlald(pairsA[i], pairsB[i], sum);
+	if (count & 1) sum += a[count - 1] * b[count - 1];
+	return sum;
+}
+
+static int64 int16SumDSP(int16 *a, int count) {
+	// Return the sum of an Int16Array by multiply-accumulating pairs of items with (1, 1).
+
+	int64 sum = 0;
+	uint32 *pairs = (uint32 *) a;
+	int pairCount = count / 2;
+	for (int i = 0; i < pairCount; i++) sum = __smlald(pairs[i], 0x00010001, sum);
+	if (count & 1) sum += a[count - 1];
+	return sum;
+}
+
+static void int16AddDSP(int16 *dst, int16 *src, int count) {
+	// Add src to dst with saturation, two items at a time.
+
+	uint32 *dstPairs = (uint32 *) dst;
+	uint32 *srcPairs = (uint32 *) src;
+	int pairCount = count / 2;
+	for (int i = 0; i < pairCount; i++) dstPairs[i] = __qadd16(dstPairs[i], srcPairs[i]);
+	if (count & 1) dst[count - 1] = saturateInt16((int64) dst[count - 1] + src[count - 1]);
+}
+
+#endif
+
+static int vectorExtremeIndex(OBJ v, int findMax) {
+	// Return the (zero-based) index of the smallest or largest item of v, or -1 if v is empty.
+
+	int count = vectorCount(v);
+	int result = -1;
+	#define EXTREME(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		if (count > 0) result = 0; \
+		for (int i = 1; i < count; i++) { \
+			if (findMax ? (items[i] > items[result]) : (items[i] < items[result])) result = i; \
+		} \
+	}
+	FOR_EACH_ITEM_TYPE(v, EXTREME)
+	#undef EXTREME
+	return result;
+}
+
+static OBJ newVectorLike(OBJ v) {
+	// Return a new vector with the same type and item count as v, filled with zeros.
+	// Note: v may move if allocation triggers a garbage collection.
+
+	int count = vectorCount(v);
+	if (IS_TYPE(v, ByteArrayType)) {
+		OBJ result = newObj(ByteArrayType, (count + 3) / 4, falseObj);
+		if (result) setByteCountAdjust(result, count);
+		return result;
+	}
+	return newPackedArray(TYPE(v), count);
+}
+
+OBJ primVectorAdd(int argCount, OBJ *args) {
+	// Add an integer or the corresponding items of another vector to the items of a vector.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ operand = args[0];
+	OBJ v = args[1];
+	if (!isVector(v)) return fail(needsVector);
+	int count = vectorCount(v);
+
+	if (isInt(operand)) {
+		int n = obj2int(operand);
+		#define ADD_INT(T, ACC, SATURATE) { \
+			T *items = ITEMS(v, T); \
+			for (int i = 0; i < count; i++) items[i] = SATURATE((ACC) items[i] + n); \
+		}
+		FOR_EACH_ITEM_TYPE(v, ADD_INT)
+		#undef ADD_INT
+		return falseObj;
+	}
+
+	if (!isVector(operand)) return fail(needsVector);
+	if (TYPE(operand) != TYPE(v)) return fail(vectorTypeMismatch);
+	if (vectorCount(operand) < count) count = vectorCount(operand);
+#if defined(__ARM_FEATURE_DSP)
+	if (IS_TYPE(v, Int16ArrayType)) {
+		int16AddDSP(ITEMS(v, int16), ITEMS(operand, int16), count);
+		return falseObj;
+	}
+#endif
+	#define ADD_VECTOR(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		T *src = ITEMS(operand, T); \
+		for (int i = 0; i < count; i++) items[i] = SATURATE((ACC) items[i] + src[i]); \
+	}
+	FOR_EACH_ITEM_TYPE(v, ADD_VECTOR)
+	#undef ADD_VECTOR
+	return falseObj;
+}
+
+OBJ primVectorScale(int argCount, OBJ *args) {
+	// Multiply the items of a vector by numerator / denominator (default 1).
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ v = args[0];
+	if (!isVector(v)) return fail(needsVector);
+	if (!isInt(args[1]) || ((argCount > 2) && !isInt(args[2]))) return fail(needsIntegerError);
+	int numerator = obj2int(args[1]);
+	int denominator = (argCount > 2) ? obj2int(args[2]) : 1;
+	if (0 == denominator) return fail(zeroDivide);
+	int count = vectorCount(v);
+
+	#define SCALE(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		for (int i = 0; i < count; i++) items[i] = SATURATE(((ACC) items[i] * numerator) / denominator); \
+	}
+	FOR_EACH_ITEM_TYPE(v, SCALE)
+	#undef SCALE
+	return falseObj;
+}
+
+OBJ primVectorClamp(int argCount, OBJ *args) {
+	// Limit the items of a vector to the range min..max.
+
+	if (argCount < 3) return fail(notEnoughArguments);
+	OBJ v = args[0];
+	if (!isVector(v)) return fail(needsVector);
+	if (!isInt(args[1]) || !isInt(args[2])) return fail(needsIntegerError);
+	int min = obj2int(args[1]);
+	int max = obj2int(args[2]);
+	int count = vectorCount(v);
+
+	#define CLAMP(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		T lo = SATURATE(min); \
+		T hi = SATURATE(max); \
+		for (int i = 0; i < count; i++) { \
+			if (items[i] < lo) items[i] = lo; \
+			else if (items[i] > hi) items[i] = hi; \
+		} \
+	}
+	FOR_EACH_ITEM_TYPE(v, CLAMP)
+	#undef CLAMP
+	return falseObj;
+}
+
+OBJ primVectorSum(int argCount, OBJ *args) {
+	// Return the sum of the items of a vector.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	OBJ v = args[0];
+	if (!isVector(v)) return fail(needsVector);
+	int count = vectorCount(v);
+	int result = 0;
+
+#if defined(__ARM_FEATURE_DSP)
+	if (IS_TYPE(v, Int16ArrayType)) return int2obj(clampToInt(int16SumDSP(ITEMS(v, int16), count)));
+#endif
+	#define SUM(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		ACC sum = 0; \
+		for (int i = 0; i < count; i++) sum += items[i]; \
+		result = ROUNDED(sum, ACC); \
+	}
+	FOR_EACH_ITEM_TYPE(v, SUM)
+	#undef SUM
+	return int2obj(result);
+}
+
+OBJ primVectorMean(int argCount, OBJ *args) {
+	// Return the mean of the items of a vector. The mean of an integer vector is truncated.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	OBJ v = args[0];
+	if (!isVector(v)) return fail(needsVector);
+	int count = vectorCount(v);
+	if (0 == count) return zeroObj;
+	int result = 0;
+
+	#define MEAN(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		ACC sum = 0; \
+		for (int i = 0; i < count; i++) sum += items[i]; \
+		result = ROUNDED(sum / count, ACC); \
+	}
+	FOR_EACH_ITEM_TYPE(v, MEAN)
+	#undef MEAN
+	return int2obj(result);
+}
+
+OBJ primVectorMin(int argCount, OBJ *args) {
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isVector(args[0])) return fail(needsVector);
+	int i = vectorExtremeIndex(args[0], false);
+	return (i < 0) ? zeroObj : int2obj(vectorAt(args[0], i));
+}
+
+OBJ primVectorMax(int argCount, OBJ *args) {
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isVector(args[0])) return fail(needsVector);
+	int i = vectorExtremeIndex(args[0], true);
+	return (i < 0) ? zeroObj : int2obj(vectorAt(args[0], i));
+}
+
+OBJ primVectorMinIndex(int argCount, OBJ *args) {
+	// Return the index of the first smallest item of a vector, or zero if it is empty.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isVector(args[0])) return fail(needsVector);
+	return int2obj(vectorExtremeIndex(args[0], false) + 1);
+}
+
+OBJ primVectorMaxIndex(int argCount, OBJ *args) {
+	// Return the index of the first largest item of a vector, or zero if it is empty.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isVector(args[0])) return fail(needsVector);
+	return int2obj(vectorExtremeIndex(args[0], true) + 1);
+}
+
+OBJ primVectorDot(int argCount, OBJ *args) {
+	// Return the dot product of two vectors of the same type. If their sizes differ,
+	// the extra items of the longer one are ignored.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ a = args[0];
+	OBJ b = args[1];
+	if (!isVector(a) || !isVector(b)) return fail(needsVector);
+	if (TYPE(a) != TYPE(b)) return fail(vectorTypeMismatch);
+	int count = vectorCount(a);
+	if (vectorCount(b) < count) count = vectorCount(b);
+	int result = 0;
+
+#if defined(__ARM_FEATURE_DSP)
+	if (IS_TYPE(a, Int16ArrayType)) {
+		return int2obj(clampToInt(int16DotDSP(ITEMS(a, int16), ITEMS(b, int16), count)));
+	}
+#endif
+	#define DOT(T, ACC, SATURATE) { \
+		T *itemsA = ITEMS(a, T); \
+		T *itemsB = ITEMS(b, T); \
+		ACC sum = 0; \
+		for (int i = 0; i < count; i++) sum += (ACC) itemsA[i] * itemsB[i]; \
+		result = ROUNDED(sum, ACC); \
+	}
+	FOR_EACH_ITEM_TYPE(a, DOT)
+	#undef DOT
+	return int2obj(result);
+}
+
+OBJ primVectorCrossings(int argCount, OBJ *args) {
+	// Return the number of times the items of a vector cross the given threshold in either
+	// direction. An item equal to the threshold counts as above it.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ v = args[0];
+	if (!isVector(v)) return fail(needsVector);
+	if (!isInt(args[1])) return fail(needsIntegerError);
+	int threshold = obj2int(args[1]);
+	int count = vectorCount(v);
+	int result = 0;
+
+	#define CROSSINGS(T, ACC, SATURATE) { \
+		T *items = ITEMS(v, T); \
+		for (int i = 1; i < count; i++) { \
+			if ((items[i - 1] >= threshold) != (items[i] >= threshold)) result++; \
+		} \
+	}
+	FOR_EACH_ITEM_TYPE(v, CROSSINGS)
+	#undef CROSSINGS
+	return int2obj(result);
+}
+
+OBJ primVectorMovingAverage(int argCount, OBJ *args) {
+	// Return a new vector of the same type and size whose ith item is the mean of the
+	// window ending at the ith item of the given vector. The first (window - 1) items
+	// average the items available. Integer means are truncated.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	if (!isVector(args[0])) return fail(needsVector);
+	if (!isInt(args[1])) return fail(needsIntegerError);
+	int window = obj2int(args[1]);
+	if (window < 1) window = 1;
+
+	tempGCRoot = args[0]; // record the source vector in case allocation triggers GC that moves it
+	OBJ result = newVectorLike(args[0]);
+	OBJ v = tempGCRoot; // restore the source vector
+	tempGCRoot = NULL;
+	if (!result) return result; // allocation failed
+	int count = vectorCount(v);
+
+	#define MOVING_AVERAGE(T, ACC, SATURATE) { \
+		T *src = ITEMS(v, T); \
+		T *dst = ITEMS(result, T); \
+		ACC sum = 0; \
+		for (int i = 0; i < count; i++) { \
+			sum += src[i]; \
+			if (i >= window) sum -= src[i - window]; \
+			int n = (i < window) ? (i + 1) : window; \
+			dst[i] = SATURATE(sum / n); \
+		} \
+	}
+	FOR_EACH_ITEM_TYPE(v, MOVING_AVERAGE)
+	#undef MOVING_AVERAGE
+	return result;
+}
+
 // Helper functions for convert primitive
 
 static OBJ stringToList(OBJ strObj) {
@@ -855,6 +1430,7 @@ static OBJ stringToList(OBJ strObj) {
 	tempGCRoot = strObj; // record strObj in case allocation triggers GC that moves it
 	OBJ result = newObj(ListType, itemCount + 1, falseObj);
 	strObj = tempGCRoot; // restore strObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 	FIELD(result, 0) = int2obj(itemCount);
 
@@ -875,6 +1451,7 @@ static OBJ stringToByteArray(OBJ strObj) {
 	tempGCRoot = strObj; // record strObj in case allocation triggers GC that moves it
 	OBJ result = newObj(ByteArrayType, wordCount, falseObj);
 	strObj = tempGCRoot; // restore strObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 	setByteCountAdjust(result, byteCount);
 
@@ -901,6 +1478,7 @@ static OBJ listToString(OBJ listObj) {
 	tempGCRoot = listObj; // record listObj in case allocation triggers GC that moves it
 	OBJ result = newString(utfByteCount);
 	listObj = tempGCRoot; // restore listObj
+	tempGCRoot = NULL;
 	if (!result) return result; // allocation failed
 
 	uint8 *s = (uint8 *) obj2str(result);
@@ -924,6 +1502,7 @@ static OBJ listToByteArray(OBJ listObj) {
 	tempGCRoot = listObj; // record listObj in case allocation triggers GC that moves it
 	OBJ result = newObj(ByteArrayType, wordCount, falseObj);
 	listObj = tempGCRoot; // restore listObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 	setByteCountAdjust(result, byteCount);
 
@@ -947,6 +1526,7 @@ static OBJ byteArrayToString(OBJ byteArrayObj) {
 	tempGCRoot = byteArrayObj; // record byteArrayObj in case allocation triggers GC that moves it
 	OBJ result = newString(byteCount);
 	byteArrayObj = tempGCRoot; // restore byteArrayObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 
 	char *src = (char *) &FIELD(byteArrayObj, 0);
@@ -965,6 +1545,7 @@ static OBJ byteArrayToList(OBJ byteArrayObj) {
 	tempGCRoot = byteArrayObj; // record byteArrayObj in case allocation triggers GC that moves it
 	OBJ result = newObj(ListType, itemCount + 1, falseObj);
 	byteArrayObj = tempGCRoot; // restore byteArrayObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 	FIELD(result, 0) = int2obj(itemCount);
 
@@ -975,12 +1556,30 @@ static OBJ byteArrayToList(OBJ byteArrayObj) {
 	return result;
 }
 
+static OBJ packedArrayToList(OBJ packedArrayObj) {
+	// Return a list containing the items of the given packed array.
+
+	int itemCount = packedArrayCount(packedArrayObj);
+	tempGCRoot = packedArrayObj; // record packedArrayObj in case allocation triggers GC that moves it
+	OBJ result = newObj(ListType, itemCount + 1, falseObj);
+	packedArrayObj = tempGCRoot; // restore packedArrayObj
+	tempGCRoot = NULL;
+	if (!result) return fail(insufficientMemoryError); // allocation failed
+	FIELD(result, 0) = int2obj(itemCount);
+
+	for (int i = 0; i < itemCount; i++) {
+		FIELD(result, i + 1) = int2obj(packedArrayAt(packedArrayObj, i));
+	}
+	return result;
+}
+
 static OBJ singletonList(OBJ anObj) {
 	// Return a singleton list containing the given object.
 
 	tempGCRoot = anObj; // record anObj in case allocation triggers GC that moves it
 	OBJ result = newObj(ListType, 2, falseObj);
 	anObj = tempGCRoot; // restore anObj
+	tempGCRoot = NULL;
 	if (!result) return fail(insufficientMemoryError); // allocation failed
 	FIELD(result, 0) = int2obj(1);
 	FIELD(result, 1) = anObj;
@@ -1070,6 +1669,10 @@ OBJ primConvertType(int argCount, OBJ *args) {
 		case IntegerType:
 			result = int2obj(evalInt(srcObj));
 			break;
+		case StringType:
+			// snapshot a string builder, since it may be modified later
+			if (IS_STRING_BUILDER(srcObj)) result = newStringFromBytes(obj2str(srcObj), stringSize(srcObj));
+			break;
 		case ListType:
 			result = stringToList(srcObj);
 			break;
@@ -1120,6 +1723,11 @@ OBJ primConvertType(int argCount, OBJ *args) {
 			break;
 		}
 		break;
+	case Int16ArrayType:
+	case Int32ArrayType:
+	case Float32ArrayType:
+		if (ListType == dstType) result = packedArrayToList(srcObj);
+		break;
 	}
 	return result;
 }
@@ -1130,6 +1738,7 @@ static PrimEntry entries[] = {
 	{"makeList", primMakeList},
 	{"range", primRange},
 	{"addLast", primListAddLast},
+	{"ensureCapacity", primListEnsureCapacity},
 	{"delete", primListDelete},
 	{"join", primJoin},
 	{"split", primSplit},
@@ -1141,6 +1750,21 @@ static PrimEntry entries[] = {
 	{"newByteArray", primNewByteArray},
 	{"asByteArray", primAsByteArray},
 	{"freeMemory", primFreeMemory},
+	{"heapStats", primHeapStats},
+	{"newStringBuilder", primNewStringBuilder},
+	{"newPackedArray", primNewPackedArray},
+	{"vectorAdd", primVectorAdd},
+	{"vectorScale", primVectorScale},
+	{"vectorClamp", primVectorClamp},
+	{"vectorSum", primVectorSum},
+	{"vectorMean", primVectorMean},
+	{"vectorMin", primVectorMin},
+	{"vectorMax", primVectorMax},
+	{"vectorMinIndex", primVectorMinIndex},
+	{"vectorMaxIndex", primVectorMaxIndex},
+	{"vectorDot", primVectorDot},
+	{"vectorCrossings", primVectorCrossings},
+	{"vectorMovingAverage", primVectorMovingAverage},
 	{"convertType", primConvertType},
 };
 
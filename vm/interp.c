@@ -22,6 +22,38 @@
 
 #define USE_TASKS true
 
+// Time slicing - A task keeps running through backward jumps (i.e. loop iterations) until its
+// time slice of TIME_SLICE_USECS is used up, then it yields to other tasks. A task also yields
+// whenever it waits or blocks. To keep the cost of a backward jump low, the clock is read only
+// after every BACKWARD_JUMP_BUDGET backward jumps, so a slice may run over by up to that many
+// loop iterations. A budget of 1 with a slice of 0 suspends on every backward jump. Boards
+// with tiny serial receive buffers use short time slices so incoming bytes are captured often.
+
+#ifndef BACKWARD_JUMP_BUDGET
+	#if defined(NRF51)
+		#define BACKWARD_JUMP_BUDGET 1
+	#elif defined(GNUBLOCKS)
+		#define BACKWARD_JUMP_BUDGET 64
+	#else
+		#define BACKWARD_JUMP_BUDGET 16
+	#endif
+#endif
+
+#ifndef TIME_SLICE_USECS
+	#if defined(NRF51)
+		#define TIME_SLICE_USECS 0
+	#elif defined(GNUBLOCKS)
+		#define TIME_SLICE_USECS 5000
+	#else
+		#define TIME_SLICE_USECS 1000
+	#endif
+#endif
+
+// Number of backward jumps taken by the last task run (used to keep the scheduler's
+// background processing rate independent of the time slice length)
+
+static int sliceJumpCount = 0;
+
 // RECENT is a threshold for waking up tasks waiting on timers
 // The timer can be up to this many usecs past the wakeup time.
 
@@ -33,6 +65,7 @@ CodeChunkRecord chunks[MAX_CHUNKS];
 
 Task tasks[MAX_TASKS];
 int taskCount = 0;
+int maxTasks = MAX_TASKS;
 
 OBJ vars[MAX_VARS];
 
@@ -84,6 +117,8 @@ static void printObj(OBJ obj) {
 		snprintf(dst, n, "[%d item list]", obj2int(FIELD(obj, 0)));
 	} else if (objType(obj) == ByteArrayType) {
 		snprintf(dst, n, "(%d bytes)", BYTES(obj));
+	} else if (IS_PACKED_ARRAY(obj)) {
+		snprintf(dst, n, "[%d item packed array]", packedArrayCount(obj));
 	} else {
 		snprintf(dst, n, "(object type: %d)", objType(obj));
 	}
@@ -133,9 +168,7 @@ OBJ lastBroadcast = zeroObj; // Note: This variable must be processed by the gar
 static void primSendBroadcast(int argCount, OBJ *args) {
 	// Variadic broadcast; all args are concatenated into printBuffer.
 	printArgs(argCount, args, false, false);
-	// save the last broadcasted message
-	lastBroadcast = newStringFromBytes(printBuffer, printBufferByteCount);
-	startReceiversOfBroadcast(printBuffer, printBufferByteCount);
+	startReceiversOfBroadcast(printBuffer, printBufferByteCount); // also sets lastBroadcast
 	sendBroadcastToIDE(printBuffer, printBufferByteCount);
 }
 
@@ -341,6 +374,9 @@ static int stringsEqual(OBJ obj1, OBJ obj2) {
 	// Return true if the given strings have the same length and contents.
 	// Assume s1 and s2 are of Strings.
 
+	if (IS_STRING_BUILDER(obj1) || IS_STRING_BUILDER(obj2)) { // may have unused words
+		return (0 == strcmp(obj2str(obj1), obj2str(obj2)));
+	}
 	int byteCount = 4 * objWords(obj1);
 	if (byteCount != (4 * objWords(obj2))) return false; // different lengths
 	char *s1 = (char *) &FIELD(obj1, 0);
@@ -365,27 +401,22 @@ static OBJ argOrDefault(OBJ *fp, int argNum, OBJ defaultValue) {
 
 static int functionNameMatches(int chunkIndex, char *functionName) {
 	// Return true if given chunk is the function with the given function name.
-	// Use the function name in the function's metadata.
-	// Scan backwards from the end of the chunk to avoid possible
-	// matches of the meta flag with offsets in instructions.
-	// Note: 248 (0xF8) is not a valid byte in UTF-8 encoding
+	// Use the function name in the function's metadata, found by parsing forward
+	// over the instructions and literals so that metadata tag bytes in instruction
+	// operands, literals, or the CRC word of a compact chunk record are never mistaken
+	// for the start of the metadata. Compact chunk records keep the function name.
 
-	const uint8 META_FLAG = 248;
-	char *metaData = NULL;
 	uint32 *code = (uint32 *) chunks[chunkIndex].code;
 	uint8 *chunkStart = (uint8 *) (code + PERSISTENT_HEADER_WORDS);
-	uint8 *src = chunkStart + (4 * code[1]) - 1; // start at last byte
-	while (src > chunkStart) {
-		if (META_FLAG == *src) {
-			metaData = (char *) src + 1;
-			break;
-		}
-		src--; // scan backwards to find start of metadata
-	}
-	if (!metaData) return false; // no metadata
-
-	// return true if metaDat starts with the given function name
-	return (strstr(metaData, functionName) == metaData);
+	int byteCount = 4 * code[1];
+	if (chunkCodeCompact == ((*code >> 16) & 0xFF)) byteCount -= 4; // skip the CRC word
+	int offset = metadataOffset(chunkStart, byteCount);
+	if (offset < 0) return false; // no metadata
+
+	// return true if the function name in the metadata equals the given function name
+	int nameSize = strlen(functionName) + 1; // include the null terminator
+	if ((offset + 1 + nameSize) > byteCount) return false;
+	return (0 == memcmp(chunkStart + offset + 1, functionName, nameSize));
 }
 
 static int chunkIndexForFunction(char *functionName) {
@@ -402,6 +433,72 @@ static int chunkIndexForFunction(char *functionName) {
 	return -1;
 }
 
+// Callee Cache
+//
+// Looking up a user-defined function by name scans the metadata of every function chunk,
+// which is slow. The callee cache remembers the result of recent successful lookups, keyed
+// by a hash of the name. Since different names can have the same hash, each hit is verified
+// against the chunk itself. Failed lookups are not cached, since they could not be verified
+// without a full scan; they are rare, since they end with a primitiveNotImplemented error.
+// The cache is cleared whenever code chunks are added, deleted, or moved.
+
+#if defined(NRF51)
+	#define CALLEE_CACHE_SIZE 8 // must be a power of 2
+#else
+	#define CALLEE_CACHE_SIZE 64 // must be a power of 2
+#endif
+
+typedef struct {
+	uint32 nameHash;
+	int chunkIndex; // chunk index of function or -1 if unused
+} CalleeCacheEntry;
+
+static CalleeCacheEntry calleeCache[CALLEE_CACHE_SIZE];
+static int calleeCacheValid = false;
+
+void clearCalleeCache() {
+	calleeCacheValid = false;
+}
+
+static uint32 nameHash(char *s) {
+	// Return a 32-bit FNV-1a hash of the given string.
+
+	uint32 h = 2166136261u;
+	while (*s) {
+		h = (h ^ (uint8) *s++) * 16777619u;
+	}
+	return h;
+}
+
+static int functionChunkMatches(int chunkIndex, char *functionName) {
+	if (functionHat != chunks[chunkIndex].chunkType) return false;
+	if (broadcastMatches(chunkIndex, functionName, strlen(functionName))) return true;
+	return functionNameMatches(chunkIndex, functionName);
+}
+
+static int cachedChunkIndexForFunction(char *functionName) {
+	// Return the chunk index for the function with the given name or -1 if not found.
+	// Use and update the callee cache.
+
+	if (!calleeCacheValid) {
+		for (int i = 0; i < CALLEE_CACHE_SIZE; i++) calleeCache[i].chunkIndex = -1;
+		calleeCacheValid = true;
+	}
+
+	uint32 h = nameHash(functionName);
+	CalleeCacheEntry *entry = &calleeCache[h & (CALLEE_CACHE_SIZE - 1)];
+	if ((entry->chunkIndex != -1) && (entry->nameHash == h)) {
+		if (functionChunkMatches(entry->chunkIndex, functionName)) return entry->chunkIndex;
+	}
+
+	int result = chunkIndexForFunction(functionName);
+	if (result >= 0) {
+		entry->nameHash = h;
+		entry->chunkIndex = result;
+	}
+	return result;
+}
+
 PrimitiveFunction findPrimitive(char *namedPrimitive);
 
 static int findCallee(char *functionOrPrimitiveName) {
@@ -409,8 +506,8 @@ static int findCallee(char *functionOrPrimitiveName) {
 	PrimitiveFunction f = findPrimitive(functionOrPrimitiveName);
 	if (f) return (int) f;
 
-	// Look for a user-defined function match (slow if no match found!)
-	int result = chunkIndexForFunction(functionOrPrimitiveName);
+	// Look for a user-defined function match (cached, since this is slow if no match found)
+	int result = cachedChunkIndexForFunction(functionOrPrimitiveName);
 	if (result >= 0) return (0xFFFFFF00 | result); // set top 24 bits to show callee is a chunk
 	// assume: result < 256 (MAX_CHUNKS) so it fits in low 8 bits
 
@@ -418,23 +515,161 @@ static int findCallee(char *functionOrPrimitiveName) {
 	return -1;
 }
 
+// Integer Operations
+//
+// Most arithmetic and comparison ops have an inline fast path for the common case where both
+// operands are integers. Other cases, such as strings that contain numbers, are handled by an
+// out-of-line slow path. Compile with -DCOUNT_SLOW_PATHS to count how often each op takes the
+// slow path; the counts are reported by the "slow path counts" debugging operation.
+
+// Selected Opcodes (see MicroBlocksCompiler.gp for complete set)
+
+#define jmpTrue 24
+#define add 50
+#define subtract 51
+#define multiply 52
+#define divide 53
+#define bitAnd 55
+#define bitOr 56
+#define bitXor 57
+#define bitInvert 58
+#define bitShiftLeft 59
+#define bitShiftRight 60
+#define lessThan 61
+#define lessOrEq 62
+#define equal 63
+#define notEqual 64
+#define greaterOrEq 65
+#define greaterThan 66
+#define absoluteValue 71
+
+#ifdef COUNT_SLOW_PATHS
+	static uint32 slowPathCounts[128];
+	#define COUNT_SLOW_PATH(op) { slowPathCounts[op]++; }
+#else
+	#define COUNT_SLOW_PATH(op)
+#endif
+
+void reportSlowPathCounts() {
+#ifdef COUNT_SLOW_PATHS
+	char s[100];
+	int found = false;
+	for (int i = 0; i < 128; i++) {
+		if (slowPathCounts[i]) {
+			snprintf(s, sizeof(s), "Opcode %d slow path: %lu", i, (unsigned long) slowPathCounts[i]);
+			outputString(s);
+			found = true;
+		}
+	}
+	if (!found) outputString("No slow paths taken");
+	memset(slowPathCounts, 0, sizeof(slowPathCounts));
+#else
+	outputString("Slow path counts not enabled (compile with -DCOUNT_SLOW_PATHS)");
+#endif
+}
+
+static inline int intOp(int op, int x, int y, OBJ *result) {
+	// Store the result of the given binary operator applied to x and y in result and
+	// return true. Return false if op is not supported or would fail.
+
+	switch (op) {
+	case add: *result = int2obj(x + y); break;
+	case subtract: *result = int2obj(x - y); break;
+	case multiply: *result = int2obj(x * y); break;
+	case divide:
+		if (0 == y) return false; // let the caller report the error
+		*result = int2obj(x / y);
+		break;
+	case bitAnd: *result = int2obj(x & y); break;
+	case bitOr: *result = int2obj(x | y); break;
+	case bitXor: *result = int2obj(x ^ y); break;
+	case bitShiftLeft: *result = int2obj(x << y); break;
+	case bitShiftRight: *result = int2obj(x >> y); break;
+	case lessThan: *result = (x < y) ? trueObj : falseObj; break;
+	case lessOrEq: *result = (x <= y) ? trueObj : falseObj; break;
+	case equal: *result = (x == y) ? trueObj : falseObj; break;
+	case notEqual: *result = (x != y) ? trueObj : falseObj; break;
+	case greaterOrEq: *result = (x >= y) ? trueObj : falseObj; break;
+	case greaterThan: *result = (x > y) ? trueObj : falseObj; break;
+	default: return false;
+	}
+	return true;
+}
+
+static OBJ __attribute__ ((noinline)) primArithmetic(int op, OBJ obj1, OBJ obj2) {
+	// Slow path for binary arithmetic and bit operations. Convert the arguments to integers
+	// (e.g. parse strings), then apply the operator.
+
+	COUNT_SLOW_PATH(op);
+	int n1 = evalInt(obj1);
+	int n2 = evalInt(obj2);
+	OBJ result = zeroObj;
+	if ((divide == op) && (0 == n2)) return fail(zeroDivide);
+	intOp(op, n1, n2, &result);
+	return result;
+}
+
+static int __attribute__ ((noinline)) evalIntSlowPath(int op, OBJ obj) {
+	// Slow path for unary integer operations.
+
+	COUNT_SLOW_PATH(op);
+	return evalInt(obj);
+}
+
+// Superinstructions
+//
+// The compiler replaces the first instruction of some common instruction sequences, such as
+// "pushLocal; pushImmediate; +; storeLocal", with a superinstruction that does the work of the
+// whole sequence in a single dispatch when the operands are integers. The rest of the sequence
+// is left in place, so code size and jump offsets are unchanged. If an operand is not an
+// integer, the superinstruction acts like the original first instruction and the rest of the
+// sequence runs normally.
+
+static inline int intBinaryOp(int op, OBJ a, OBJ b, OBJ *result) {
+	// If a and b are integers, store the result of the given binary operator in result
+	// and return true. Otherwise, or if the operation would fail, return false.
+
+	if (!isInt(a) || !isInt(b)) return false;
+	return intOp(op, obj2int(a), obj2int(b), result);
+}
+
 // Interpreter
 
 // Macros to pop arguments for commands and reporters (pops args, leaves result on stack)
 #define POP_ARGS_COMMAND() { sp -= arg; }
 #define POP_ARGS_REPORTER() { sp -= arg - 1; }
 
-// Macro to check for stack overflow
+// Macro to check for stack overflow, growing the stack if possible
 #define STACK_CHECK(n) { \
-	if (((sp + (n)) - task->stack) > STACK_LIMIT) { \
-		errorCode = stackOverflow; \
-		goto error; \
+	if (((sp + (n)) - task->stack) > task->stackSize) { \
+		task->sp = sp - task->stack; \
+		task->fp = fp - task->stack; \
+		if (!growTaskStack(task, (sp + (n)) - task->stack)) { \
+			errorCode = stackOverflow; \
+			goto error; \
+		} \
+		sp = task->stack + task->sp; /* stack may have moved */ \
+		fp = task->stack + task->fp; \
 	} \
 }
 
 // Macros to support function calls
 #define IN_CALL() (fp > task->stack)
 
+// Macro to count a backward jump and suspend the task when its time slice is used up
+#if TIME_SLICE_USECS
+	#define SLICE_USED_UP() ((microsecs() - sliceStart) >= TIME_SLICE_USECS)
+#else
+	#define SLICE_USED_UP() true
+#endif
+#define BACKWARD_JUMP() { \
+	if (--jumpBudget <= 0) { \
+		if (SLICE_USED_UP()) goto suspend; \
+		sliceJumps += BACKWARD_JUMP_BUDGET; \
+		jumpBudget = BACKWARD_JUMP_BUDGET; \
+	} \
+}
+
 static void interpDebug(int ip, int cmd, int arg, int sp) {
 	// Show interpreter state for debugging.
 
@@ -443,11 +678,26 @@ static void interpDebug(int ip, int cmd, int arg, int sp) {
 	outputString(tmpStr); \
 }
 
+// Macro to count opcode dispatches when profiling
+#ifdef PROFILER
+	#define PROFILE_DISPATCH() { \
+		if (profiling) { \
+			profileChunkCounts[task->currentChunkIndex]++; \
+			profileOpCounts[CMD(op)]++; \
+			profileSiteChunk = task->currentChunkIndex; \
+			profileSiteIP = (ip - 1) - (int16 *) task->code; \
+		} \
+	}
+#else
+	#define PROFILE_DISPATCH()
+#endif
+
 // Macro to inline dispatch in the end of each opcode (avoiding a jump back to the top)
 #define DISPATCH() { \
 	if (errorCode) goto error; \
 	op = *ip++; \
 	arg = ARG(op); \
+	PROFILE_DISPATCH(); \
 	task->sp = sp - task->stack; /* record stack pointer for garbage collector */ \
 	/* interpDebug((ip - (int16 *) task->code), CMD(op), arg, task->sp); */ \
 	goto *jumpTable[CMD(op)]; \
@@ -467,6 +717,11 @@ static void runTask(Task *task) {
 	register OBJ *fp;
 	int arg, tmp;
 	OBJ tmpObj;
+	int jumpBudget = BACKWARD_JUMP_BUDGET; // backward jumps until the next time check
+	int sliceJumps = 0; // backward jumps taken before the last time check
+	#if TIME_SLICE_USECS
+		uint32 sliceStart = microsecs();
+	#endif
 
 	// initialize jump table
 	static void *jumpTable[] = {
@@ -570,12 +825,12 @@ static void runTask(Task *task) {
 		&&spiSend_op,
 		&&spiRecv_op,
 	&&RESERVED_op,
-	&&RESERVED_op,					// 100
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
+		&&pushLocalConstOp_op,		// 100 superinstructions (see comment above intBinaryOp)
+		&&pushGlobalConstOp_op,
+		&&pushLocalConstJmp_op,
+		&&pushGlobalConstJmp_op,
+		&&updateLocal_op,
+		&&updateGlobal_op,			// 105
 	&&RESERVED_op,
 	&&RESERVED_op,
 	&&RESERVED_op,
@@ -600,6 +855,16 @@ static void runTask(Task *task) {
 		&&codeEnd_op,				// 127 (alias for halt_op)
 	};
 
+	if (!task->stack) { // allocate a stack when the task first runs
+		if (!growTaskStack(task, INITIAL_STACK_WORDS)) {
+			tmp = (task->ip << 8) | (task->currentChunkIndex & 0xFF);
+			sendTaskError(task->taskChunkIndex, insufficientMemoryError, tmp);
+			task->status = unusedTask;
+			if (unusedTask == tasks[taskCount - 1].status) taskCount--;
+			return;
+		}
+	}
+
 	// Restore task state
 	ip = (int16 *) task->code + task->ip;
 	sp = task->stack + task->sp;
@@ -629,6 +894,8 @@ static void runTask(Task *task) {
 		task->ip = ip - (int16 *) task->code;
 		task->sp = sp - task->stack;
 		task->fp = fp - task->stack;
+		sliceJumpCount = sliceJumps + (BACKWARD_JUMP_BUDGET - jumpBudget);
+		if (unusedTask == task->status) releaseTaskStack(task); // task is done
 		return;
 	RESERVED_op:
 	halt_op:
@@ -706,6 +973,54 @@ static void runTask(Task *task) {
 	incrementLocal_op:
 		*(fp + arg) = int2obj(obj2int(*(fp + arg)) + evalInt(*--sp));
 		DISPATCH();
+
+	// Superinstructions. On entry, ip points to the pushImmediate that follows the
+	// superinstruction and arg is the local or global index of the original first instruction.
+	pushLocalConstOp_op:
+		// pushLocal; pushImmediate; <binary op>
+		if (!intBinaryOp(CMD(ip[1]), *(fp + arg), (OBJ) ARG(ip[0]), &tmpObj)) goto pushLocal_op;
+		STACK_CHECK(1);
+		*sp++ = tmpObj;
+		ip += 2;
+		DISPATCH();
+	pushGlobalConstOp_op:
+		// pushGlobal; pushImmediate; <binary op>
+		if (!intBinaryOp(CMD(ip[1]), vars[arg], (OBJ) ARG(ip[0]), &tmpObj)) goto pushGlobal_op;
+		STACK_CHECK(1);
+		*sp++ = tmpObj;
+		ip += 2;
+		DISPATCH();
+	pushLocalConstJmp_op:
+		// pushLocal; pushImmediate; <comparison>; jmpTrue or jmpFalse
+		if (!intBinaryOp(CMD(ip[1]), *(fp + arg), (OBJ) ARG(ip[0]), &tmpObj)) goto pushLocal_op;
+		goto fusedConditionalJump;
+	pushGlobalConstJmp_op:
+		// pushGlobal; pushImmediate; <comparison>; jmpTrue or jmpFalse
+		if (!intBinaryOp(CMD(ip[1]), vars[arg], (OBJ) ARG(ip[0]), &tmpObj)) goto pushGlobal_op;
+	fusedConditionalJump:
+		ip += 2;
+		op = *ip++; // the conditional jump
+		arg = ARG(op);
+		if (!arg) arg = *ip++; // zero arg means offset is in the next word
+		if ((trueObj == tmpObj) == (jmpTrue == CMD(op))) {
+			ip += arg;
+#if USE_TASKS
+			if (arg < 0) BACKWARD_JUMP();
+#endif
+		}
+		DISPATCH();
+	updateLocal_op:
+		// pushLocal; pushImmediate; <binary op>; storeLocal
+		if (!intBinaryOp(CMD(ip[1]), *(fp + arg), (OBJ) ARG(ip[0]), &tmpObj)) goto pushLocal_op;
+		*(fp + ARG(ip[2])) = tmpObj;
+		ip += 3;
+		DISPATCH();
+	updateGlobal_op:
+		// pushGlobal; pushImmediate; <binary op>; storeGlobal
+		if (!intBinaryOp(CMD(ip[1]), vars[arg], (OBJ) ARG(ip[0]), &tmpObj)) goto pushGlobal_op;
+		vars[ARG(ip[2])] = tmpObj;
+		ip += 3;
+		DISPATCH();
 	pop_op:
 	ignoreArgs_op:
 		sp -= arg;
@@ -720,22 +1035,28 @@ static void runTask(Task *task) {
 		if (!arg) arg = *ip++; // zero arg means offset is in the next word
 		ip += arg;
 #if USE_TASKS
-		if (arg < 0) goto suspend;
+		if (arg < 0) BACKWARD_JUMP();
 #endif
 		DISPATCH();
 	jmpTrue_op:
 		if (!arg) arg = *ip++; // zero arg means offset is in the next word
 		if (trueObj == (*--sp)) ip += arg;
 #if USE_TASKS
-		if ((arg < 0) && (trueObj == *sp)) goto suspend;
+		if ((arg < 0) && (trueObj == *sp)) BACKWARD_JUMP();
 #endif
 		DISPATCH();
 	jmpFalse_op:
+		if (!arg) arg = *ip++; // zero arg means offset is in the next word
+		if (trueObj != (*--sp)) ip += arg; // treat any value but true as false
+#if USE_TASKS
+		if ((arg < 0) && (trueObj != *sp)) BACKWARD_JUMP();
+#endif
+		DISPATCH();
 	waitUntil_op:
 		if (!arg) arg = *ip++; // zero arg means offset is in the next word
 		if (trueObj != (*--sp)) ip += arg; // treat any value but true as false
 #if USE_TASKS
-		if ((arg < 0) && (trueObj != *sp)) goto suspend;
+		if ((arg < 0) && (trueObj != *sp)) goto suspend; // waiting; always yield
 #endif
 		DISPATCH();
 	 decrementAndJmp_op:
@@ -749,10 +1070,9 @@ static void runTask(Task *task) {
 			ip += arg; // loop counter >= 0, so branch
 			*(sp - 1) = int2obj(tmp); // update loop counter
 #if USE_TASKS
-			goto suspend;
-#else
-			DISPATCH();
+			BACKWARD_JUMP();
 #endif
+			DISPATCH();
 		} else {
 			sp--; // loop done, pop loop counter
 		}
@@ -854,6 +1174,8 @@ static void runTask(Task *task) {
 				tmp = countUTF8(obj2str(tmpObj));
 			} else if (IS_TYPE(tmpObj, ByteArrayType)) {
 				tmp = BYTES(tmpObj);
+			} else if (IS_PACKED_ARRAY(tmpObj)) {
+				tmp = packedArrayCount(tmpObj);
 			} else {
 				fail(badForLoopArg);
 				goto error;
@@ -878,6 +1200,9 @@ static void runTask(Task *task) {
 			} else if (IS_TYPE(tmpObj, ByteArrayType)) {
 				// set the index variable to the next byte of a byte array
 				*(fp + arg) = int2obj(((uint8 *) &FIELD(tmpObj, 0))[tmp]);
+			} else if (IS_PACKED_ARRAY(tmpObj)) {
+				// set the index variable to the next item of a packed array
+				*(fp + arg) = int2obj(packedArrayAt(tmpObj, tmp));
 			} else {
 				fail(badForLoopArg);
 				goto error;
@@ -940,6 +1265,7 @@ static void runTask(Task *task) {
 		if (isInt(tmpObj) && isInt(*(sp - 1))) { // special case for integers:
 			*(sp - arg) = (obj2int(tmpObj) < obj2int(*(sp - 1))) ? trueObj : falseObj;
 		} else {
+			COUNT_SLOW_PATH(lessThan);
 			*(sp - arg) = primCompare(-2, tmpObj, *(sp - 1));
 		}
 		POP_ARGS_REPORTER();
@@ -949,6 +1275,7 @@ static void runTask(Task *task) {
 		if (isInt(tmpObj) && isInt(*(sp - 1))) { // special case for integers:
 			*(sp - arg) = (obj2int(tmpObj) <= obj2int(*(sp - 1))) ? trueObj : falseObj;
 		} else {
+			COUNT_SLOW_PATH(lessOrEq);
 			*(sp - arg) = primCompare(-1, tmpObj, *(sp - 1));
 		}
 		POP_ARGS_REPORTER();
@@ -962,8 +1289,10 @@ static void runTask(Task *task) {
 		} else if (isInt(tmpObj) && isInt(*(sp - 1))) {
 			*(sp - arg) = falseObj; // integer, not equal
 		} else if (IS_TYPE(tmpObj, StringType) && IS_TYPE(*(sp - 1), StringType)) {
+			COUNT_SLOW_PATH(equal);
 			*(sp - arg) = (stringsEqual(tmpObj, *(sp - 1)) ? trueObj : falseObj);
 		} else {
+			COUNT_SLOW_PATH(equal);
 			*(sp - arg) = falseObj; // not comparable, so not equal
 		}
 		POP_ARGS_REPORTER();
@@ -977,8 +1306,10 @@ static void runTask(Task *task) {
 		} else if (isInt(tmpObj) && isInt(*(sp - 1))) {
 			*(sp - arg) = trueObj; // integer, not equal
 		} else if (IS_TYPE(tmpObj, StringType) && IS_TYPE(*(sp - 1), StringType)) {
+			COUNT_SLOW_PATH(notEqual);
 			*(sp - arg) = (stringsEqual(tmpObj, *(sp - 1)) ? falseObj : trueObj);
 		} else {
+			COUNT_SLOW_PATH(notEqual);
 			*(sp - arg) = trueObj; // not comparable, so not equal
 		}
 		POP_ARGS_REPORTER();
@@ -988,6 +1319,7 @@ static void runTask(Task *task) {
 		if (isInt(tmpObj) && isInt(*(sp - 1))) { // special case for integers:
 			*(sp - arg) = (obj2int(tmpObj) >= obj2int(*(sp - 1))) ? trueObj : falseObj;
 		} else {
+			COUNT_SLOW_PATH(greaterOrEq);
 			*(sp - arg) = primCompare(1, tmpObj, *(sp - 1));
 		}
 		POP_ARGS_REPORTER();
@@ -997,6 +1329,7 @@ static void runTask(Task *task) {
 		if (isInt(tmpObj) && isInt(*(sp - 1))) { // special case for integers:
 			*(sp - arg) = (obj2int(tmpObj) > obj2int(*(sp - 1))) ? trueObj : falseObj;
 		} else {
+			COUNT_SLOW_PATH(greaterThan);
 			*(sp - arg) = primCompare(2, tmpObj, *(sp - 1));
 		}
 		POP_ARGS_REPORTER();
@@ -1006,20 +1339,39 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	add_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) + evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) + obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(add, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	subtract_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) - evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) - obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(subtract, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	multiply_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) * evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) * obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(multiply, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	divide_op:
-		tmp = evalInt(*(sp - 1));
-		*(sp - arg) = ((0 == tmp) ? fail(zeroDivide) : int2obj(evalInt(*(sp - 2)) / tmp));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1)) && (zeroObj != *(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) / obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(divide, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	modulo_op:
@@ -1027,7 +1379,9 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	absoluteValue_op:
-		*(sp - arg) = int2obj(abs(evalInt(*(sp - 1))));
+		tmpObj = *(sp - 1);
+		tmp = isInt(tmpObj) ? obj2int(tmpObj) : evalIntSlowPath(absoluteValue, tmpObj);
+		*(sp - arg) = int2obj(abs(tmp));
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	random_op:
@@ -1041,27 +1395,54 @@ static void runTask(Task *task) {
 
 	// bit operations:
 	bitAnd_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) & evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) & obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(bitAnd, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	bitOr_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) | evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) | obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(bitOr, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	bitXor_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) ^ evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) ^ obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(bitXor, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	bitInvert_op:
-		*(sp - arg) = int2obj(~evalInt(*(sp - 1)));;
+		tmpObj = *(sp - 1);
+		tmp = isInt(tmpObj) ? obj2int(tmpObj) : evalIntSlowPath(bitInvert, tmpObj);
+		*(sp - arg) = int2obj(~tmp);
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	bitShiftLeft_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) << evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) << obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(bitShiftLeft, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	bitShiftRight_op:
-		*(sp - arg) = int2obj(evalInt(*(sp - 2)) >> evalInt(*(sp - 1)));
+		tmpObj = *(sp - 2);
+		if (isInt(tmpObj) && isInt(*(sp - 1))) { // fast path for integers
+			*(sp - arg) = int2obj(obj2int(tmpObj) >> obj2int(*(sp - 1)));
+		} else {
+			*(sp - arg) = primArithmetic(bitShiftRight, tmpObj, *(sp - 1));
+		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	longMultiply_op:
@@ -1301,6 +1682,10 @@ static void runTask(Task *task) {
 				if (arg == 2) { // has an optional parameters list (the second argument)
 					if (IS_TYPE(params, ListType)) { // push the parameters onto the stack
 						paramCount = (obj2int(FIELD(params, 0)) & 0xFF);
+						tempGCRoot = params; // record params in case growing the stack triggers GC
+						STACK_CHECK(paramCount);
+						params = tempGCRoot;
+						tempGCRoot = NULL;
 						for (int i = 1; i <= paramCount; i++) {
 							*sp++ = FIELD(params, i);
 						}
@@ -1329,14 +1714,132 @@ static void runTask(Task *task) {
 		DISPATCH();
 }
 
+#if !defined(EMSCRIPTEN)
+
+// Task Scheduling
+//
+// Runnable tasks are kept in a FIFO ring of task indices and tasks waiting on the
+// microsecond clock are kept in a min-heap ordered by wake time, so the scheduler does
+// not need to scan the task list. Tasks that are stopped or restarted while in the ring
+// or heap are not removed; stale entries are detected and discarded when they are reached.
+//
+// Heap entries are ordered by how far their wake times are past (now - RECENT). That
+// ordering does not change as time advances provided that tasks are woken within RECENT
+// usecs of their wake time, which is the same condition the wakeup test itself assumes.
+
+typedef struct {
+	uint32 wakeTime;
+	uint8 taskIndex;
+} WakeEntry;
+
+#define WAKE_HEAP_SIZE (2 * MAX_TASKS) // room for stale entries
+static WakeEntry wakeHeap[WAKE_HEAP_SIZE];
+static int wakeHeapCount = 0;
+
+static uint8 runRing[MAX_TASKS];
+static uint8 inRunRing[MAX_TASKS]; // true if a task index is in runRing
+static int runRingStart = 0;
+static int runRingCount = 0;
+
+void scheduleTask(int taskIndex) {
+	// Add the given task to the end of the runnable ring, if it is not already there.
+
+	if ((taskIndex < 0) || (taskIndex >= MAX_TASKS) || inRunRing[taskIndex]) return;
+	runRing[(runRingStart + runRingCount) % MAX_TASKS] = taskIndex;
+	runRingCount++;
+	inRunRing[taskIndex] = true;
+}
+
+static int nextRunnableTask() {
+	// Remove and return the index of the next runnable task or -1 if there isn't one.
+
+	while (runRingCount > 0) {
+		int i = runRing[runRingStart];
+		runRingStart = (runRingStart + 1) % MAX_TASKS;
+		runRingCount--;
+		inRunRing[i] = false;
+		if (running == tasks[i].status) return i;
+	}
+	return -1;
+}
+
+static inline uint32 wakeKey(uint32 wakeTime, uint32 now) {
+	return wakeTime - (now - RECENT);
+}
+
+static void wakeHeapRemoveTop(uint32 now) {
+	wakeHeap[0] = wakeHeap[--wakeHeapCount];
+	int i = 0;
+	while (true) { // sift down
+		int smallest = i;
+		int child = (2 * i) + 1;
+		for (int c = child; (c <= child + 1) && (c < wakeHeapCount); c++) {
+			if (wakeKey(wakeHeap[c].wakeTime, now) < wakeKey(wakeHeap[smallest].wakeTime, now)) smallest = c;
+		}
+		if (smallest == i) return;
+		WakeEntry tmp = wakeHeap[i];
+		wakeHeap[i] = wakeHeap[smallest];
+		wakeHeap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+static void wakeHeapAdd(int taskIndex, uint32 now) {
+	if (wakeHeapCount >= WAKE_HEAP_SIZE) {
+		// heap is full of stale entries; rebuild it from the task list
+		wakeHeapCount = 0;
+		for (int t = 0; t < MAX_TASKS; t++) {
+			if ((t != taskIndex) && (waiting_micros == tasks[t].status)) wakeHeapAdd(t, now);
+		}
+	}
+	int i = wakeHeapCount++;
+	wakeHeap[i].wakeTime = tasks[taskIndex].wakeTime;
+	wakeHeap[i].taskIndex = taskIndex;
+	while (i > 0) { // sift up
+		int parent = (i - 1) / 2;
+		if (wakeKey(wakeHeap[parent].wakeTime, now) <= wakeKey(wakeHeap[i].wakeTime, now)) return;
+		WakeEntry tmp = wakeHeap[i];
+		wakeHeap[i] = wakeHeap[parent];
+		wakeHeap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void wakeDueTasks(uint32 now) {
+	// Move tasks whose wake time has arrived from the wake heap to the runnable ring.
+
+	while (wakeHeapCount > 0) {
+		WakeEntry *top = &wakeHeap[0];
+		if ((now - top->wakeTime) >= RECENT) return; // earliest wake time has not yet arrived
+		Task *task = &tasks[top->taskIndex];
+		if ((waiting_micros == task->status) && (task->wakeTime == top->wakeTime)) {
+			task->status = running;
+			scheduleTask(top->taskIndex);
+		}
+		wakeHeapRemoveTop(now);
+	}
+}
+
+static void taskSuspended(int taskIndex) {
+	// Reschedule the given task after it has been run.
+
+	Task *task = &tasks[taskIndex];
+	if (running == task->status) {
+		scheduleTask(taskIndex);
+	} else if (waiting_micros == task->status) {
+		wakeHeapAdd(taskIndex, microsecs());
+	}
+}
+
 // Interpreter Entry Point
 
-#if !defined(EMSCRIPTEN)
+#ifdef GNUBLOCKS
+	#define MAX_NAP_USECS 10000 // upper limit on the time spent waiting for input when idle
+#endif
 
 void vmLoop() {
 	// Run the next runnable task. Wake up any waiting tasks whose wakeup time has arrived.
 
-	int currentTaskIndex = 0;
 	int count = 0;
 	while (true) {
 		if (count-- < 0) {
@@ -1355,26 +1858,19 @@ void vmLoop() {
 			captureIncomingBytes();
 		}
 		int runCount = 0;
-		uint32 usecs = 0; // compute times only the first time they are needed
-		for (int t = 0; t < taskCount; t++) {
-			currentTaskIndex++;
-			if (currentTaskIndex >= taskCount) currentTaskIndex = 0;
-			Task *task = &tasks[currentTaskIndex];
-			if (unusedTask == task->status) {
-				continue;
-			} else if (running == task->status) {
-				runTask(task);
-				runCount++;
-				break;
-			} else if (waiting_micros == task->status) {
-				if (!usecs) usecs = microsecs(); // get usecs
-				if ((usecs - task->wakeTime) < RECENT) {
-					task->status = running;
-					runTask(task);
-					runCount++;
-					break;
-				}
-			}
+		sliceJumpCount = 0;
+		if (wakeHeapCount > 0) wakeDueTasks(microsecs());
+		int taskIndex = nextRunnableTask();
+		if (taskIndex >= 0) {
+			runTask(&tasks[taskIndex]);
+			taskSuspended(taskIndex);
+			runCount++;
+		}
+		gcStep(); // do a bounded amount of garbage collection work, if needed
+		if (sliceJumpCount > 1) {
+			// count each loop iteration of a long time slice as a VM loop cycle
+			count -= sliceJumpCount - 1;
+			captureIncomingBytes();
 		}
 		if (taskSleepMSecs) {
 			// if any task called taskSleep(), do VM background tasks sooner
@@ -1383,19 +1879,17 @@ void vmLoop() {
 		}
 
 #ifdef GNUBLOCKS
-		if (!runCount) { // no active tasks; consider taking a nap
-			if (!usecs) usecs = microsecs(); // get usecs
-			int sleepUSecs = 500;
-			for (int i = 0; i < taskCount; i++) {
-				Task *task = &tasks[i];
-				if (waiting_micros == task->status) {
-					int usecsUntilWake = (task->wakeTime - usecs) - 5; // leave 5 extra usecs
-					if ((usecsUntilWake > 0) && (usecsUntilWake < sleepUSecs)) {
-						sleepUSecs = usecsUntilWake;
-					}
-				}
+		if (!runCount) { // no active tasks; wait for input or the next wake time
+			uint32 sleepUSecs = MAX_NAP_USECS;
+			if (wakeHeapCount > 0) {
+				// the earliest wake time is in the future since due tasks were just woken
+				uint32 usecsUntilWake = (wakeHeap[0].wakeTime - microsecs()) - 5; // leave 5 extra usecs
+				if (usecsUntilWake < sleepUSecs) sleepUSecs = usecsUntilWake;
+			}
+			if (sleepUSecs > 5) {
+				waitForInput(sleepUSecs); // relinquish the CPU
+				count = -1; // do background VM tasks next
 			}
-			if (sleepUSecs > 5) usleep(sleepUSecs); // nap a while to relinquish the CPU
 		}
 #endif
 	}
@@ -1416,6 +1910,8 @@ void EMSCRIPTEN_KEEPALIVE taskSleep(int msecs) { shouldYield = true; }
 
 static int currentTaskIndex = 0; // remember this across calls to interpretStep()
 
+void scheduleTask(int taskIndex) { } // interpretStep() scans the task list
+
 void interpretStep() {
 	uint32 endTime = millisecs() + 15;
 	processMessage();
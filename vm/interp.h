@@ -20,6 +20,9 @@ extern "C" {
 #define CMD(n) (n & 0x7F) // use only low 7 bits for now
 #define ARG(n) (n >> 8)
 
+int instructionWords(int16 *ip);
+int metadataOffset(uint8 *code, int byteCount);
+
 // Global Variables
 
 #define MAX_VARS 128
@@ -40,6 +43,10 @@ extern OBJ vars[MAX_VARS];
 // newer versions of a chunk are appended to the end of Flash. At startup time, Flash memory
 // is scanned, and the chunks[] table is reconstructed with references to the latest version
 // of each chunk.
+//
+// Each entry also caches the CRC-32 of its chunk, which the IDE uses to find out which chunks
+// have changed. The CRC is computed when the chunk is stored or restored, so answering the
+// IDE's CRC requests does not require reading every chunk.
 
 typedef enum {
 	unusedChunk = 0,
@@ -56,6 +63,7 @@ typedef enum {
 
 typedef struct {
 	OBJ code;
+	uint32 crc; // CRC-32 of the chunk's code (valid if code is not NULL)
 	uint8 chunkType;
 } CodeChunkRecord;
 
@@ -69,8 +77,9 @@ extern CodeChunkRecord chunks[MAX_CHUNKS];
 // inside a call to user-defined function. It also holds the task status, processor
 // state (instruction pointer (ip), stack pointer (sp), and frame pointer (fp)),
 // and the wakeTime (used when a task is waiting on the microsecond clock).
-// In the current design, Tasks have a fixed-size stack built in. In the future,
-// this will become a reference to a growable stack object in memory.
+// Task stacks are allocated from the top of the object store (see mem.c) when a task
+// first runs. They start small, grow as needed up to STACK_LIMIT words, and their
+// space is returned to the object heap when the task ends.
 //
 // "When <condition>" hats have their condition test compiled into them. They
 // loop back and suspend themselves when the condition is false. When the condition
@@ -82,29 +91,49 @@ typedef enum {
 	running = 2,
 } MicroBlocksTaskStatus_t;
 
-#ifdef GNUBLOCKS
-	#define STACK_LIMIT 10000 // Task size is 6 + STACK_LIMIT words
-#else
-	#define STACK_LIMIT 54 // Task size is 6 + STACK_LIMIT words
-#endif
+#define INITIAL_STACK_WORDS 16 // initial stack size in words
 
 typedef struct {
 	uint8 status; // MicroBlocksTaskStatus_t, stored as a byte
 	uint8 taskChunkIndex; // chunk index of the top-level stack for this task
 	uint8 currentChunkIndex; // chunk index when inside a function
+	uint16 sp;
+	uint16 fp;
+	uint16 stackSize; // in words
+	uint16 stackHighWater; // most stack words used; updated when the stack is released
 	uint32 wakeTime;
 	OBJ code;
 	int ip; // ip offset in code
-	int sp;
-	int fp;
-	OBJ stack[STACK_LIMIT];
+	OBJ *stack; // NULL until the task first runs
 } Task;
 
 // Task list shared by interp.c and runtime.c
+// MAX_TASKS can be set at build time. maxTasks may be lowered by memInit() on boards
+// with too little RAM to give each task a minimal stack.
+
+#ifndef MAX_TASKS
+	#if defined(NRF51)
+		#define MAX_TASKS 10
+	#elif defined(GNUBLOCKS)
+		#define MAX_TASKS 64
+	#else
+		#define MAX_TASKS 32
+	#endif
+#endif
+
+#if MAX_TASKS > 255
+	#error "MAX_TASKS must be under 256"
+#endif
 
-#define MAX_TASKS 10
 extern Task tasks[MAX_TASKS];
 extern int taskCount;
+extern int maxTasks;
+
+// Task stack allocation (in mem.c)
+
+int growTaskStack(Task *task, int minWords);
+void releaseTaskStack(Task *task);
+int taskStackHighWater(Task *task);
 
 // Extra delay used to limit serial transmission speed
 
@@ -153,7 +182,22 @@ extern int extraByteDelay;
 
 #define getAllCRCsMsg			38
 #define allCRCsMsg				39
-#define LAST_MSG				39
+
+// Serial Protocol Messages: Task Statistics
+
+#define getTaskStatsMsg			40
+#define taskStatsMsg			41
+
+// Serial Protocol Messages: Profiler
+
+#define profileMsg				42
+#define profileDataMsg			43
+
+// Serial Protocol Messages: Chunk Batches
+
+#define chunkBatchMsg			44
+#define chunkBatchAckMsg		45
+#define LAST_MSG				45
 
 // Error Codes (codes 1-9 are reserved for protocol errors; 10 and up are runtime errors)
 
@@ -205,6 +249,10 @@ extern int extraByteDelay;
 #define bad8BitBitmap			51	// Needs an 8-bit bitmap: a list containing the bitmap width and contents (a byte array)
 #define badColorPalette			52	// Needs a color palette: a list of positive 24-bit integers representing RGB values
 #define encoderNotStarted		53	// Encoder not started; pin may not support interrupts
+#define tooManyTasks			54	// Too many tasks; no free task entries
+#define packedArrayStoreError	55	// An Int16Array can only store integer values between -32768 and 32767
+#define needsVector				56	// Needs a byte array or packed array
+#define vectorTypeMismatch		57	// Both vectors must have the same item type
 #define sleepSignal				255	// Not a real error; used to make current task sleep
 
 // Runtime Operations
@@ -215,6 +263,7 @@ void initTasks(void);
 void startAll();
 void stopAllTasksButThis(Task *task);
 void startReceiversOfBroadcast(char *msg, int byteCount);
+void copyBroadcastLiteral();
 void processMessage(void);
 int hasOutputSpace(int byteCount);
 void logData(char *s);
@@ -225,7 +274,9 @@ void sendTaskReturnValue(uint8 chunkIndex, OBJ returnValue);
 void sendBroadcastToIDE(char *s, int len);
 int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount);
 void sendSayForChunk(char *s, int len, uint8 chunkIndex);
+uint32 chunkCRC(OBJ code);
 void vmLoop(void);
+void scheduleTask(int taskIndex);
 void interpretStep();
 void taskSleep(int msecs);
 void vmPanic(const char *s);
@@ -254,6 +305,7 @@ static inline int evalInt(OBJ obj) {
 
 // Testing Support
 
+void storeCodeChunk(uint8 chunkIndex, int byteCount, uint8 *data);
 void startTaskForChunk(uint8 chunkIndex);
 void runTasksUntilDone(void);
 
@@ -276,6 +328,7 @@ int recvBytes(uint8 *buf, int count);
 int sendBytes(uint8 *buf, int start, int end);
 void captureIncomingBytes();
 void restartSerial();
+void waitForInput(int usecs);
 
 const char *boardType();
 void hardwareInit(void);
@@ -440,6 +493,35 @@ OBJ callPrimitive(int argCount, OBJ *args);
 OBJ newPrimitiveCall(PrimitiveSetIndex setIndex, const char *primName, int argCount, OBJ *args);
 void primsInit();
 
+// Primitive Cache (maps named primitive call sites to primitive functions)
+
+void primCacheClear();
+void primCacheAddChunk(int chunkIndex);
+void primCacheRebuild();
+
+void clearCalleeCache();
+void reportSlowPathCounts();
+
+// Profiler (included only when compiled with -DPROFILER)
+
+#ifdef PROFILER
+extern int profiling;
+extern uint32 profileChunkCounts[MAX_CHUNKS];
+extern uint32 profileOpCounts[128];
+extern uint32 profileAllocatedWords;
+extern uint32 profileGCCount;
+extern uint32 profileGCUSecs;
+extern uint8 profileSiteChunk;
+extern uint16 profileSiteIP;
+
+void profileRecordPrimitive(int setIndex, const char *primName, PrimitiveFunction f, uint32 usecs);
+void profileRecordAllocation(uint32 words);
+void profileRecordGC(uint32 usecs);
+void profileRecordMessage(uint32 usecs);
+#endif
+
+void processProfileMsg(int op);
+
 #ifdef __cplusplus
 }
 #endif
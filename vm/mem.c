@@ -28,6 +28,8 @@
 // the next. The final chunk is always a free chunk. The object allocator carves objects off the
 // free chunk until it is no longer large enough for a desired allocation. At that point, the
 // garbage collector/compactor is run, consolidating all free space into the final free chunk.
+// Small objects may also be allocated from free lists of chunks that were freed without
+// compaction (see Free Lists below).
 //
 // Every chunk starts with a header word with its size and type:
 //
@@ -35,7 +37,13 @@
 //
 // An extra header word, called the "forwarding field" is reserved immediately before the header
 // word of each chunk. That field is used by the marking phase of the garbage collector and to
-// update (forward) references of objects that move during compaction and object resizing.
+// update (forward) references to objects that move during compaction.
+//
+// Task stacks are allocated from the top of the object store, above the final free chunk.
+// They are not objects and the garbage collector does not scan or move them, but the
+// objects they refer to (up to each task's stack pointer) are treated as roots. When a
+// stack grows or a task ends, the remaining stacks are slid up to the top of the object
+// store and any space they no longer need is added to the free chunk.
 
 #if defined(NRF51)
   #define OBJSTORE_BYTES 1200
@@ -78,7 +86,24 @@
   // max that compiles for all boards is 16886 (17624 NodeMCU)
 #endif
 
-#define OBJSTORE_WORDS ((OBJSTORE_BYTES / 4) + 4)
+// The object store has room for the initial stacks of MAX_TASKS tasks in addition to
+// OBJSTORE_BYTES. Its size is capped so that the initial free chunk fits the 16-bit word
+// count of an object header.
+
+#define STACK_RESERVE_WORDS (MAX_TASKS * INITIAL_STACK_WORDS)
+#define UNCAPPED_OBJSTORE_WORDS ((OBJSTORE_BYTES / 4) + 4 + STACK_RESERVE_WORDS)
+#define OBJSTORE_WORDS ((UNCAPPED_OBJSTORE_WORDS > 0xFFFF) ? 0xFFFF : UNCAPPED_OBJSTORE_WORDS)
+
+_Static_assert(OBJSTORE_WORDS <= 0xFFFF, "OBJSTORE_WORDS is too large for the object header word count");
+
+// A task stack can grow to a quarter of the object store, up to a per-platform maximum.
+
+#ifdef GNUBLOCKS
+  #define MAX_STACK_WORDS 10000
+#else
+  #define MAX_STACK_WORDS 1000
+#endif
+#define STACK_LIMIT (((OBJSTORE_WORDS / 4) < MAX_STACK_WORDS) ? (OBJSTORE_WORDS / 4) : MAX_STACK_WORDS)
 
 #if defined(ARDUINO_ARCH_ESP32)
   static OBJ *objstore = NULL; // allocated from heap on ESP32
@@ -88,12 +113,35 @@
 
 static OBJ memStart = NULL;
 static OBJ memEnd = NULL;
+static OBJ heapEnd = NULL; // end of the object heap; task stacks are above this
 static OBJ freeChunk = NULL;
 
+#define MAX_FREE_LIST_WORDS 8
+
+static OBJ freeLists[MAX_FREE_LIST_WORDS + 1]; // see Free Lists below
+static int freeListWords = 0; // total words in free list chunks
+
+static OBJ markStart = NULL; // objects below this are not marked (see minorGC())
+
 OBJ tempGCRoot = NULL; // used during resizeObj() and primitives that allocate multiple objects
 
 extern OBJ lastBroadcast; // an additional GC root
 
+// Forward References
+
+static void replaceReferences(OBJ oldObj, OBJ newRef);
+static void objectResized(OBJ oldObj, OBJ newRef);
+static void objectGrownInPlace(OBJ obj, int extraWords);
+static void resetIncrementalGC();
+static void resetNursery();
+static void remember(OBJ obj);
+static void clearFreeLists();
+static void gcShade(OBJ obj);
+static void collectGarbage(int mustCompact);
+static void minorGC();
+static void reclaimSpace(int wordsNeeded);
+void gc();
+
 // Initialization
 
 void memInit() {
@@ -110,7 +158,13 @@ void memInit() {
 	// initialize object heap memory
 	memStart = (OBJ) objstore;
 	memEnd = (OBJ) (objstore + OBJSTORE_WORDS);
+	heapEnd = memEnd;
+	markStart = memStart;
 	memClear();
+
+	// limit the number of tasks so that initial task stacks use at most a quarter of memory
+	int taskLimit = OBJSTORE_WORDS / (4 * (INITIAL_STACK_WORDS + 2));
+	if (taskLimit < maxTasks) maxTasks = taskLimit;
 }
 
 void memClear() {
@@ -120,17 +174,27 @@ void memClear() {
 	for (int i = 0; i < MAX_VARS; i++) vars[i] = zeroObj;
 	lastBroadcast = zeroObj;
 
-	// zero objectstore memory (not essential)
-	memset(objstore, 0, sizeof(objstore));
+	// zero objectstore memory below the task stacks (not essential)
+	memset(objstore, 0, 4 * (heapEnd - memStart));
 
 	// create the free chunk (prefixed by a forwarding word)
 	objstore[0] = (OBJ) 0; // forwarding word
-	objstore[1] = (OBJ) HEADER(FREE_CHUNK, OBJSTORE_WORDS - 2); // free chunk
+	objstore[1] = (OBJ) HEADER(FREE_CHUNK, (heapEnd - (OBJ) &objstore[1]) - 1); // free chunk
 	freeChunk = (OBJ) &objstore[1];
+	clearFreeLists();
+	resetIncrementalGC();
+	resetNursery();
+}
+
+int isReadOnly(OBJ obj) {
+	// Return true if obj is an object outside the object store, such as a string literal.
+
+	if (isInt(obj) || isBoolean(obj)) return false;
+	return (obj < memStart) || (obj >= memEnd);
 }
 
 int wordsFree() {
-	int result = WORDS(freeChunk) - 2;
+	int result = WORDS(freeChunk) - 2 + freeListWords;
 	return (result < 0) ? 0 : result;
 }
 
@@ -144,29 +208,153 @@ void vmPanic(const char *errorMessage) {
 	while (true) processMessage(); // there's no way to recover; loop forever!
 }
 
-// Forward References
+// Free Lists
+//
+// Free chunks left by resizeObj() and by garbage collections that do not compact memory
+// are kept on free lists so they can be reused for small objects. freeLists[n] holds free
+// chunks of exactly n words for 1 <= n <= MAX_FREE_LIST_WORDS, and freeLists[0] holds larger
+// free chunks, which are split as needed. The first field of a free chunk links it to the
+// next chunk on its list. The free lists are emptied when memory is compacted.
+
+static void clearFreeLists() {
+	memset(freeLists, 0, sizeof(freeLists));
+	freeListWords = 0;
+}
 
-void applyForwarding();
-void clearForwardingFields();
-void gc();
+static void addFreeChunk(OBJ chunk, int wordCount) {
+	// Make chunk a free chunk with the given number of words and add it to a free list.
+
+	*(chunk - 1) = 0; // clear forwarding field
+	*chunk = HEADER(FREE_CHUNK, wordCount);
+	if (wordCount < 1) return; // no room for the free list link
+
+	int i = (wordCount <= MAX_FREE_LIST_WORDS) ? wordCount : 0;
+	FIELD(chunk, 0) = freeLists[i];
+	freeLists[i] = chunk;
+	freeListWords += wordCount;
+}
+
+static OBJ takeFreeChunk(int wordCount) {
+	// Remove and return a free list chunk with the given number of words.
+	// Return NULL if wordCount is too large for the free lists or no chunk is available.
+
+	if ((wordCount < 1) || (wordCount > MAX_FREE_LIST_WORDS)) return NULL;
+
+	OBJ result = freeLists[wordCount];
+	if (result) { // exact fit
+		freeLists[wordCount] = FIELD(result, 0);
+		freeListWords -= wordCount;
+		return result;
+	}
+
+	// split the first large chunk that can hold wordCount words plus a free chunk header
+	OBJ *link = &freeLists[0];
+	while ((result = *link)) {
+		int available = WORDS(result);
+		if (available >= (wordCount + 2)) {
+			*link = FIELD(result, 0);
+			freeListWords -= available;
+			addFreeChunk(result + wordCount + 2, available - (wordCount + 2)); // the remainder
+			return result;
+		}
+		link = &FIELD(result, 0);
+	}
+	return NULL;
+}
+
+// Nursery
+//
+// The objects allocated at or above nurseryStart since the last garbage collection form the
+// nursery. Most of them are temporaries. A minor garbage collection (see minorGC()) reclaims
+// unused nursery objects without scanning the rest of memory and promotes the survivors by
+// moving nurseryStart up to the free chunk.
+//
+// The remembered set records the older objects that may refer to nursery objects. It is
+// fed by WRITE_BARRIER(), by resizeObj(), by allocating objects with pointer fields from
+// the free lists, and by promoting tempGCRoot. If the remembered set overflows, the next
+// collection is a full one.
+// Global variables and task stacks are always roots, so storing into them needs no barrier.
+
+#ifndef NURSERY_PERCENT
+  #define NURSERY_PERCENT 12 // do a minor collection when the nursery reaches this % of the heap
+#endif
+
+#if defined(NRF51)
+  #define REMEMBERED_SET_SIZE 8
+#else
+  #define REMEMBERED_SET_SIZE 64
+#endif
+
+OBJ nurseryStart = NULL;
+int minorGCCount = 0;
+int majorGCCount = 0;
+
+static OBJ rememberedSet[REMEMBERED_SET_SIZE];
+static int rememberedCount = 0;
+static int rememberedOverflow = false;
+
+static void resetNursery() {
+	// Promote all objects and start a new, empty nursery.
+
+	nurseryStart = freeChunk;
+	rememberedCount = 0;
+	rememberedOverflow = false;
+
+	// A primitive may still be storing new objects into tempGCRoot, which has just been
+	// promoted. Remember it so that the next minor collection scans its fields.
+	OBJ root = tempGCRoot;
+	if (root && !isInt(root) && !isBoolean(root) && !isReadOnly(root) && (TYPE(root) > BinaryObjectTypes)) {
+		remember(root);
+	}
+}
+
+static void remember(OBJ obj) {
+	// Add the given object to the remembered set.
+
+	for (int i = rememberedCount - 1; i >= 0; i--) {
+		if (rememberedSet[i] == obj) return; // already remembered
+	}
+	if (rememberedCount < REMEMBERED_SET_SIZE) {
+		rememberedSet[rememberedCount++] = obj;
+	} else {
+		rememberedOverflow = true;
+	}
+}
+
+void gcWriteBarrier(OBJ obj, OBJ value) {
+	// Called by WRITE_BARRIER() before value is stored into a field of obj.
+
+	if (isInt(value) || isBoolean(value) || isReadOnly(value)) return; // not in the object store
+	if (gcMarking) gcShade(value);
+	if ((value >= nurseryStart) && (obj < nurseryStart)) remember(obj);
+}
 
 // Object Allocation
 
 OBJ newObj(int type, int wordCount, OBJ fill) {
 	// Allocate a new object of the given size.
 
-	// check available space
-	int available = WORDS(freeChunk);
-	if (available < (wordCount + 2)) {
-		gc();
-		available = WORDS(freeChunk); // retry after garbage collection
-		if (available < (wordCount + 2)) return fail(insufficientMemoryError);
-	}
+	OBJ result = takeFreeChunk(wordCount);
+	if (result) {
+		// an older object allocated from a free list may be given references to nursery objects
+		if ((result < nurseryStart) && (type > BinaryObjectTypes)) remember(result);
+	} else {
+		// check available space
+		int available = WORDS(freeChunk);
+		if (available < (wordCount + 2)) {
+			reclaimSpace(wordCount + 2);
+			available = WORDS(freeChunk); // retry after garbage collection
+			if (available < (wordCount + 2)) return fail(insufficientMemoryError);
+		}
 
-	// allocate result and update freeChunk
-	OBJ result = (OBJ) freeChunk;
-	freeChunk += wordCount + 2;
-	*freeChunk = HEADER(FREE_CHUNK, available - (wordCount + 2));
+		// allocate result and update freeChunk
+		result = (OBJ) freeChunk;
+		freeChunk += wordCount + 2;
+		*freeChunk = HEADER(FREE_CHUNK, available - (wordCount + 2));
+	}
+#ifdef PROFILER
+	if (profiling) profileRecordAllocation(wordCount + 2);
+#endif
 
 	// initialize and return the new object
 	*(result - 1) = 0; // clear its forwarding word
@@ -177,12 +365,38 @@ OBJ newObj(int type, int wordCount, OBJ fill) {
 	return result;
 }
 
+OBJ newPackedArray(int typeID, int count) {
+	// Allocate a packed array of the given type with count items, all zero.
+
+	int wordCount = (Int16ArrayType == typeID) ? ((count + 1) / 2) : count;
+	OBJ result = newObj(typeID, wordCount, 0);
+	if (result) setByteCountAdjust(result, 2 * count);
+	return result;
+}
+
 OBJ resizeObj(OBJ oldObj, int wordCount) {
-	// Change the size of the given object to wordCount and return the new object.
+	// Change the size of the given object to wordCount and return the new object. An object
+	// just before the free chunk grows in place. Otherwise, the object is copied and references
+	// to it are replaced, which requires a scan of the heap.
 
 	if (isInt(oldObj)) return oldObj;
 	if ((oldObj < memStart) || (oldObj >= memEnd)) return oldObj; // object must be in object store
 
+	int oldWords = WORDS(oldObj);
+	int extra = wordCount - oldWords;
+	if ((extra > 0) && ((oldObj + oldWords + 2) == freeChunk) && (WORDS(freeChunk) >= extra)) {
+		// oldObj is just before the free chunk; grow it in place without moving it
+		int available = WORDS(freeChunk);
+		if (nurseryStart == freeChunk) nurseryStart += extra; // keep the empty nursery empty
+		freeChunk += extra;
+		*(freeChunk - 1) = 0; // clear the free chunk's forwarding field
+		*freeChunk = HEADER(FREE_CHUNK, available - extra);
+		*oldObj = HEADER(TYPE(oldObj), wordCount);
+		for (int i = oldWords; i < wordCount; i++) FIELD(oldObj, i) = zeroObj;
+		objectGrownInPlace(oldObj, extra);
+		return oldObj;
+	}
+
 	tempGCRoot = oldObj; // record oldObj in case newObj() triggers GC that moves it
 	OBJ result = newObj(TYPE(oldObj), wordCount, zeroObj);
 	oldObj = tempGCRoot; // restore oldObj
@@ -193,15 +407,103 @@ OBJ resizeObj(OBJ oldObj, int wordCount) {
 	if (wordCount < copyCount) copyCount = wordCount; // new size is smaller
 	memcpy(result + 1, oldObj + 1, 4 * copyCount); // copy from the old to the new body
 
-	clearForwardingFields();
-	*(oldObj - 1) = (uint32) result; // point forwarding field of oldObj to result
-	applyForwarding();
-	*(oldObj - 1) = 0; // clear forwarding field
-	*oldObj = HEADER(FREE_CHUNK, WORDS(oldObj)); // mark oldObj free
+	// Note: Don't use the forwarding fields here; they hold marks during incremental marking.
+	replaceReferences(oldObj, result);
+	objectResized(oldObj, result);
+	addFreeChunk(oldObj, WORDS(oldObj)); // make oldObj free and available for reuse
 
 	return result;
 }
 
+// Task Stacks
+
+// Unused stack words are filled with STACK_PAINT so the stack high-water mark can be found.
+// STACK_PAINT is neither an integer nor a valid object reference.
+#define STACK_PAINT ((OBJ) 0xFFFFFFFE)
+
+int taskStackHighWater(Task *task) {
+	// Return the maximum number of stack words the given task has used.
+
+	if (!task->stack) return task->stackHighWater;
+	int i = task->stackSize;
+	while ((i > 0) && (STACK_PAINT == task->stack[i - 1])) i--;
+	return (i > task->stackHighWater) ? i : task->stackHighWater;
+}
+
+static void freeStack(Task *task) {
+	task->stackHighWater = taskStackHighWater(task);
+	task->stack = NULL;
+	task->stackSize = 0;
+}
+
+static void compactTaskStacks() {
+	// Slide the stacks of active tasks to the top of the object store, closing any gaps
+	// left by stacks that were released or replaced, and add the space gained to the free chunk.
+
+	OBJ *dst = (OBJ *) memEnd;
+	OBJ *done = (OBJ *) memEnd; // stacks at or above this address have been moved
+	while (true) {
+		// find the highest stack that has not yet been moved
+		Task *next = NULL;
+		for (int i = 0; i < MAX_TASKS; i++) {
+			Task *task = &tasks[i];
+			if (!task->stack) continue;
+			if (unusedTask == task->status) { // task ended without releasing its stack
+				freeStack(task);
+				continue;
+			}
+			if ((task->stack < done) && (!next || (task->stack > next->stack))) next = task;
+		}
+		if (!next) break;
+		done = next->stack;
+		dst -= next->stackSize;
+		if (dst != next->stack) memmove(dst, next->stack, 4 * next->stackSize);
+		next->stack = dst;
+	}
+	int gained = (OBJ) dst - heapEnd;
+	if (gained > 0) {
+		*freeChunk = HEADER(FREE_CHUNK, WORDS(freeChunk) + gained);
+		heapEnd = (OBJ) dst;
+	}
+}
+
+int growTaskStack(Task *task, int minWords) {
+	// Give the given task a stack of at least minWords, preserving the contents of its
+	// current stack, if any. Return false if there is not enough memory or if minWords
+	// exceeds STACK_LIMIT. The caller must save the task's sp, since the stack will move.
+
+	if (minWords > STACK_LIMIT) return false;
+	int newSize = task->stackSize ? (2 * task->stackSize) : INITIAL_STACK_WORDS;
+	while (newSize < minWords) newSize *= 2;
+	if (newSize > STACK_LIMIT) newSize = STACK_LIMIT;
+
+	compactTaskStacks();
+	if (WORDS(freeChunk) < (newSize + 2)) {
+		reclaimSpace(newSize + 2);
+		if (WORDS(freeChunk) < (newSize + 2)) return false;
+	}
+
+	// take the new stack from the end of the free chunk
+	*freeChunk = HEADER(FREE_CHUNK, WORDS(freeChunk) - newSize);
+	heapEnd -= newSize;
+	OBJ *newStack = (OBJ *) heapEnd;
+	int oldSize = task->stack ? task->stackSize : 0;
+	if (oldSize) memcpy(newStack, task->stack, 4 * oldSize);
+	for (int i = oldSize; i < newSize; i++) newStack[i] = STACK_PAINT;
+	task->stack = newStack;
+	task->stackSize = newSize;
+
+	compactTaskStacks(); // reclaim the old stack
+	return true;
+}
+
+void releaseTaskStack(Task *task) {
+	// Return the given task's stack space to the object heap.
+
+	freeStack(task);
+	compactTaskStacks();
+}
+
 // String Primitives
 
 OBJ newString(int byteCount) {
@@ -224,6 +526,15 @@ OBJ newStringFromBytes(const char *bytes, int byteCount) {
 	return result;
 }
 
+OBJ newStringBuilder(int capacity) {
+	// Allocate an empty string builder that can hold capacity bytes.
+
+	int wordCount = (((capacity + 1) + 3) / 4) + 1; // leave room for terminator and length word
+	OBJ result = newObj(StringType, wordCount, 0);
+	if (result) *result |= STRING_BUILDER_FLAG;
+	return result;
+}
+
 char* obj2str(OBJ obj) {
 	if (isInt(obj)) return (char *) "<Integer>";
 	if (isBoolean(obj)) return (char *) ((trueObj == obj) ? "true" : "false");
@@ -233,6 +544,55 @@ char* obj2str(OBJ obj) {
 	return (char *) "<Object>";
 }
 
+// Heap Statistics
+
+static uint32 gcUSecs = 0; // total time spent in garbage collection
+
+void getHeapStats(HeapStats *stats) {
+	// Scan object memory and fill in stats. Object counts include unreachable objects that
+	// have not yet been collected.
+
+	memset(stats, 0, sizeof(HeapStats));
+	uint32 *end = (uint32 *) heapEnd;
+	uint32 *next = (uint32 *) objstore + 1;
+	while (next < end) {
+		int wordCount = WORDS(next);
+		int type = TYPE(next);
+		if (type) {
+			stats->objectCounts[type]++;
+			stats->objectWords[type] += wordCount + 2;
+		} else {
+			stats->freeWords += wordCount;
+			if (wordCount > stats->largestFreeChunk) stats->largestFreeChunk = wordCount;
+		}
+		next += wordCount + 2;
+	}
+	if (stats->freeWords > 0) {
+		stats->fragmentation = (100 * (stats->freeWords - stats->largestFreeChunk)) / stats->freeWords;
+	}
+	stats->gcCount = minorGCCount + majorGCCount;
+	stats->gcMSecs = gcUSecs / 1000;
+}
+
+void reportHeapStats() {
+	HeapStats stats;
+	char s[100];
+
+	getHeapStats(&stats);
+	const char *typeNames[] = {"ByteArray", "String", "Array", "List"};
+	const int typeIDs[] = {ByteArrayType, StringType, ArrayType, ListType};
+	for (int i = 0; i < 4; i++) {
+		int type = typeIDs[i];
+		sprintf(s, "%s: %d objects, %d words", typeNames[i], stats.objectCounts[type], stats.objectWords[type]);
+		outputString(s);
+	}
+	sprintf(s, "Free: %d words; largest free chunk %d words; %d%% fragmented",
+		stats.freeWords, stats.largestFreeChunk, stats.fragmentation);
+	outputString(s);
+	sprintf(s, "GC: %d minor, %d full, %d msecs", minorGCCount, majorGCCount, stats.gcMSecs);
+	outputString(s);
+}
+
 // Debugging Utilities
 
 void reportNum(const char *msg, int n) {
@@ -273,7 +633,7 @@ void dumpObjectStore() {
 	char s[100];
 
 	outputString("Object store:");
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) heapEnd;
 	uint32 *next = (uint32 *) objstore + 1;
 	uint32 *base = (uint32 *) objstore;
 	while (next < end) {
@@ -320,18 +680,6 @@ void memDumpObj(OBJ obj) {
 
 // Object Forwarding
 
-void clearForwardingFields() {
-	// Set all forwarding fields to zero. This may not be needed if we maintain the invariant
-	// that forward fields are zero except during garbage collection or forwarding operations.
-
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
-	uint32 *next = (uint32 *) objstore + 1;
-	while (next < end) {
-		*(next - 1) = 0; // clear forwarding field
-		next += WORDS(next) + 2;
-	}
-}
-
 static inline OBJ forward(OBJ obj) {
 	if (isInt(obj)) return obj;
 	if ((obj < memStart) || (obj > memEnd)) return obj; // outside the object store
@@ -349,7 +697,7 @@ static void forwardRoots(void) {
 	// forward objects on Task stacks
 	for (int i = 0; i < taskCount; i++) {
 		Task *task = &tasks[i];
-		if (task->status != unusedTask) {
+		if ((task->status != unusedTask) && task->stack) {
 			for (int j = tasks[i].sp - 1; j >= 0; j--) {
 				task->stack[j] = forward(task->stack[j]);
 			}
@@ -357,25 +705,38 @@ static void forwardRoots(void) {
 	}
 }
 
-void applyForwarding() {
-	// Update all forwarded references.
+static inline OBJ replaceRef(OBJ obj, OBJ oldObj, OBJ newRef) {
+	return (obj == oldObj) ? newRef : obj;
+}
+
+static void replaceReferences(OBJ oldObj, OBJ newRef) {
+	// Replace all references to oldObj with references to newRef.
 
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) heapEnd;
 	uint32 *next = (uint32 *) objstore + 1;
 	while (next < end) {
 		if (TYPE(next) > BinaryObjectTypes) { // non-free chunk with OBJ fields (not a string)
 			for (int i = WORDS(next); i > 0; i--) {
-				OBJ child = (OBJ) next[i];
-				if (!isInt(child) && // child is not an integer
-					((memStart < child) && (child <= memEnd)) && // child is in the object store
-					*(child - 1)) { // child has a non-zero forwarding field
-						next[i] = *(child - 1); // update the forwarded OBJ
+				if ((OBJ) next[i] == oldObj) {
+					next[i] = (uint32) newRef;
+					if ((newRef >= nurseryStart) && ((OBJ) next < nurseryStart)) remember((OBJ) next);
 				}
 			}
 		}
 		next += WORDS(next) + 2;
 	}
-	forwardRoots();
+
+	// replace references in roots
+	for (int i = 0; i < MAX_VARS; i++) vars[i] = replaceRef(vars[i], oldObj, newRef);
+	lastBroadcast = replaceRef(lastBroadcast, oldObj, newRef);
+	for (int i = 0; i < taskCount; i++) {
+		Task *task = &tasks[i];
+		if ((task->status != unusedTask) && task->stack) {
+			for (int j = tasks[i].sp - 1; j >= 0; j--) {
+				task->stack[j] = replaceRef(task->stack[j], oldObj, newRef);
+			}
+		}
+	}
 }
 
 // Mark-Sweep-Compact Garbage Collector
@@ -383,12 +744,15 @@ void applyForwarding() {
 #define SET_MARK(obj) ((*(((uint32 *) (obj)) - 1)) = 1)
 #define IS_MARKED(obj) (*(((uint32 *) (obj)) - 1))
 
+static int markedWords = 0; // words in marked objects, including their headers
+
 void mark(OBJ root) {
 	// Mark all objects reachable from the given root.
 
 	if (isInt(root)) return;
-	if ((root < memStart) || (root > memEnd)) return; // ignore objects outside the object store
+	if ((root < markStart) || (root > memEnd)) return; // ignore objects outside the object store
 	if (IS_MARKED(root)) return; // already marked
+	markedWords += WORDS(root) + 2;
 
 	OBJ current = root;
 	int i = WORDS(current); // scan backwards from last field
@@ -408,8 +772,9 @@ void mark(OBJ root) {
 
 		// process next child
 		OBJ child = (OBJ) current[i];
-		if (!isInt(child) && (memStart <= child) && (child <= memEnd) && !IS_MARKED(child)) {
+		if (!isInt(child) && (markStart <= child) && (child <= memEnd) && !IS_MARKED(child)) {
 			// child an unmarked, non-integer object in the object store
+			markedWords += WORDS(child) + 2;
 			if (TYPE(child) > BinaryObjectTypes) { // child has pointer fields to process
 				// reverse pointers before processing child
 				current[i] = *child; // store child's header it ith field of current
@@ -437,7 +802,7 @@ static void markRoots(void) {
 	// mark objects on Task stacks
 	for (int i = 0; i < taskCount; i++) {
 		Task *task = &tasks[i];
-		if (task->status != unusedTask) {
+		if ((task->status != unusedTask) && task->stack) {
 			for (int j = tasks[i].sp - 1; j >= 0; j--) {
 				mark(task->stack[j]);
 			}
@@ -445,11 +810,177 @@ static void markRoots(void) {
 	}
 }
 
-void sweep() {
-	// Scan object memory and set the forwarding fields of surviving objects that will move.
+// Incremental Marking
+//
+// To reduce GC pauses, most of the marking work can be done in small steps between task
+// time slices. Once half of the free space left by the last garbage collection has been
+// allocated, gcStep() shades the roots (marks them and pushes those with pointer fields
+// onto the gray stack). Each subsequent call to gcStep() scans gray objects until its time
+// budget, gcPauseUSecs, is used up. Objects allocated during marking are not marked; they
+// are found when the roots are marked again at the end of marking.
+//
+// While marking is in progress, WRITE_BARRIER() (see mem.h) shades any object before a
+// reference to it is stored into an existing object, so an object that has already been
+// scanned never refers to an unmarked object. When the gray stack is empty, gc() marks
+// from the roots again and then does the sweep and compaction in a single pause.
+//
+// If the gray stack overflows, the marked objects are rescanned to find any unmarked
+// objects that were missed.
+
+#ifndef GC_PAUSE_USECS
+  #define GC_PAUSE_USECS 500
+#endif
+
+#if defined(NRF51)
+  #define GRAY_STACK_SIZE 16
+#else
+  #define GRAY_STACK_SIZE 256
+#endif
+
+int gcMarking = false;
+int gcPauseUSecs = GC_PAUSE_USECS;
+
+static OBJ grayStack[GRAY_STACK_SIZE];
+static int grayCount = 0;
+static int grayOverflow = false;
+static int freeWordsAfterGC = 0;
+
+static void resetIncrementalGC() {
+	gcMarking = false;
+	grayCount = 0;
+	grayOverflow = false;
+	freeWordsAfterGC = WORDS(freeChunk);
+}
+
+static void gcShade(OBJ obj) {
+	// Mark the given object and, if it has pointer fields, push it onto the gray stack.
+
+	if (isInt(obj)) return;
+	if ((obj < memStart) || (obj >= memEnd)) return; // ignore objects outside the object store
+	if (IS_MARKED(obj)) return; // already marked
+
+	SET_MARK(obj);
+	markedWords += WORDS(obj) + 2;
+	if (TYPE(obj) <= BinaryObjectTypes) return; // no pointer fields
+	if (grayCount < GRAY_STACK_SIZE) {
+		grayStack[grayCount++] = obj;
+	} else {
+		grayOverflow = true; // obj will be scanned by rescanMarkedObjects()
+	}
+}
+
+static inline void scanObject(OBJ obj) {
+	// Shade the children of the given object.
+
+	if (TYPE(obj) <= BinaryObjectTypes) return; // no pointer fields (or freed by resizeObj())
+	for (int i = WORDS(obj); i > 0; i--) gcShade((OBJ) obj[i]);
+}
+
+static void shadeRoots() {
+	for (int i = 0; i < MAX_VARS; i++) gcShade(vars[i]);
+	gcShade(lastBroadcast);
+	if (tempGCRoot) gcShade(tempGCRoot);
+	for (int i = 0; i < taskCount; i++) {
+		Task *task = &tasks[i];
+		if ((task->status != unusedTask) && task->stack) {
+			for (int j = tasks[i].sp - 1; j >= 0; j--) {
+				gcShade(task->stack[j]);
+			}
+		}
+	}
+}
+
+static void rescanMarkedObjects() {
+	// Called after the gray stack overflows. Scan all marked objects to shade their children.
 
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	grayOverflow = false;
+	uint32 *end = (uint32 *) heapEnd;
 	uint32 *next = (uint32 *) objstore + 1;
+	while (next < end) {
+		if (IS_MARKED(next)) {
+			scanObject((OBJ) next);
+			while (grayCount > 0) scanObject(grayStack[--grayCount]);
+		}
+		next += WORDS(next) + 2;
+	}
+}
+
+static void finishMarking() {
+	// Complete an incremental marking cycle.
+
+	while (true) {
+		while (grayCount > 0) scanObject(grayStack[--grayCount]);
+		if (!grayOverflow) break;
+		rescanMarkedObjects();
+	}
+	gcMarking = false;
+
+	// Every marked object has now been scanned, so the marker can start at the roots again
+	// to find objects that were allocated during marking or are referenced only from roots.
+	markRoots();
+}
+
+static void objectResized(OBJ oldObj, OBJ newRef) {
+	// Called by resizeObj() after references to oldObj have been replaced by newRef.
+
+	if (gcMarking && IS_MARKED(oldObj)) gcShade(newRef);
+}
+
+static void objectGrownInPlace(OBJ obj, int extraWords) {
+	// Called by resizeObj() after obj has grown into the free chunk. Its new fields hold zeroObj.
+
+	if (gcMarking && IS_MARKED(obj)) markedWords += extraWords;
+}
+
+void gcStep() {
+	// Do a bounded amount of incremental garbage collection work. Called by vmLoop().
+
+	if (!gcMarking && ((100 * (freeChunk - nurseryStart)) >= (NURSERY_PERCENT * (heapEnd - memStart)))) {
+		// the nursery is full; a minor collection is not safe if the remembered set overflowed
+		if (rememberedOverflow) {
+			gc();
+		} else {
+			minorGC();
+		}
+		return;
+	}
+	if (!gcMarking) {
+		if (WORDS(freeChunk) > (freeWordsAfterGC / 2)) return; // not time to collect yet
+		gcMarking = true;
+		markedWords = 0;
+		shadeRoots();
+	}
+
+	uint32 startUSecs = microsecs();
+	int count = 0;
+	while (grayCount > 0) {
+		scanObject(grayStack[--grayCount]);
+		if ((0 == (++count & 0xF)) && ((microsecs() - startUSecs) >= (uint32) gcPauseUSecs)) {
+			return; // time budget used up
+		}
+	}
+	if (grayOverflow) {
+		rescanMarkedObjects();
+		return;
+	}
+	collectGarbage(false); // marking is done; sweep and, if needed, compact
+}
+
+// Compaction
+//
+// Compaction takes two passes over the heap. sweep() sets the forwarding fields of surviving
+// objects, in address order. When it reaches an object, every object below it has already
+// been assigned its new address, so sweep() also updates the object's references to those
+// objects (and to itself). compact() updates the remaining references, which point to
+// objects above the object being moved and have not yet moved. The roots are forwarded
+// between the two passes.
+
+void sweep(OBJ start) {
+	// Scan object memory from start, set the forwarding fields of surviving objects that will
+	// move, and update references from surviving objects to objects at or below them.
+
+	uint32 *end = (uint32 *) heapEnd;
+	uint32 *next = (uint32 *) start;
 	uint32 *dst = next;
 	while (next < end) {
 		uint32 wordCount = WORDS(next);
@@ -457,6 +988,14 @@ void sweep() {
 			// set the forwarding field to dst if the object will move, zero if not
 			*(next - 1) = (dst != next) ? (uint32) dst : 0;
 			dst += wordCount + 2;
+			if (TYPE(next) > BinaryObjectTypes) { // object with OBJ fields (not a string)
+				for (int i = wordCount; i > 0; i--) {
+					OBJ child = (OBJ) next[i];
+					if (!isInt(child) && (memStart <= child) && (child <= (OBJ) next)) {
+						next[i] = (uint32) forward(child);
+					}
+				}
+			}
 		} else { // inaccessible object or free chunk
 			// mark chunk as free by clearing its type field
 			*next = HEADER(FREE_CHUNK, wordCount);
@@ -465,15 +1004,53 @@ void sweep() {
 	}
 }
 
-void compact() {
-	// Consolidate free space into a single free chunk.
+static void sweepToFreeLists() {
+	// Free unmarked objects without moving any objects and clear the marks of the rest.
+	// Runs of adjacent free chunks are merged and added to the free lists, except for
+	// a run just before the free chunk, which is merged into the free chunk.
 
+	clearFreeLists();
+	uint32 *end = (uint32 *) freeChunk;
 	uint32 *next = (uint32 *) objstore + 1;
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *freeStart = NULL; // start of the current run of free chunks
+	while (next < end) {
+		uint32 wordCount = WORDS(next);
+		if (*(next - 1)) { // surviving object
+			*(next - 1) = 0; // clear mark
+			if (freeStart) {
+				addFreeChunk((OBJ) freeStart, (next - freeStart) - 2);
+				freeStart = NULL;
+			}
+		} else if (!freeStart) {
+			freeStart = next;
+		}
+		next += wordCount + 2;
+	}
+	if (freeStart) {
+		*(freeStart - 1) = 0;
+		*freeStart = HEADER(FREE_CHUNK, ((uint32 *) heapEnd - freeStart) - 1);
+		freeChunk = (OBJ) freeStart;
+	}
+}
+
+void compact(OBJ start) {
+	// Update references to objects that have not yet moved and consolidate free space from
+	// start to the end of the object heap into a single free chunk.
+
+	uint32 *next = (uint32 *) start;
+	uint32 *end = (uint32 *) heapEnd;
 	uint32 *dst = next;
 	while (next < end) {
 		uint32 wordCount = WORDS(next);
 		if (TYPE(next)) { // live object chunk
+			if (TYPE(next) > BinaryObjectTypes) { // object with OBJ fields (not a string)
+				for (int i = wordCount; i > 0; i--) {
+					OBJ child = (OBJ) next[i];
+					if (!isInt(child) && ((OBJ) next < child) && (child < memEnd)) {
+						next[i] = (uint32) forward(child);
+					}
+				}
+			}
 			if (dst != next) memmove(dst, next, 4 * (wordCount + 1)); // move object, if necessary
 			dst += wordCount + 1;
 			*dst++ = 0; // forwarding word
@@ -485,8 +1062,88 @@ void compact() {
 	freeChunk = (OBJ) dst;
 }
 
+// Minor Garbage Collection
+
+static void removeNurseryFreeChunks() {
+	// Remove nursery chunks from the free lists before the nursery is compacted.
+
+	for (int i = 0; i <= MAX_FREE_LIST_WORDS; i++) {
+		OBJ *link = &freeLists[i];
+		while (*link) {
+			OBJ chunk = *link;
+			if (chunk >= nurseryStart) {
+				freeListWords -= WORDS(chunk);
+				*link = FIELD(chunk, 0);
+			} else {
+				link = &FIELD(chunk, 0);
+			}
+		}
+	}
+}
+
+static void minorGC() {
+	// Reclaim unused objects in the nursery, compact it, and promote the surviving objects.
+
+	captureIncomingBytes();
+	uint32 usecs = microsecs();
+
+	// mark nursery objects reachable from the roots and from the remembered set
+	markStart = nurseryStart;
+	markRoots();
+	for (int i = 0; i < rememberedCount; i++) {
+		OBJ obj = rememberedSet[i];
+		if (TYPE(obj) <= BinaryObjectTypes) continue; // freed by resizeObj()
+		for (int j = WORDS(obj); j > 0; j--) mark((OBJ) obj[j]);
+	}
+	markStart = memStart;
+
+	removeNurseryFreeChunks();
+	sweep(nurseryStart);
+	forwardRoots();
+	for (int i = 0; i < rememberedCount; i++) {
+		OBJ obj = rememberedSet[i];
+		if (TYPE(obj) <= BinaryObjectTypes) continue;
+		for (int j = WORDS(obj); j > 0; j--) obj[j] = (int) forward((OBJ) obj[j]);
+	}
+	compact(nurseryStart);
+	resetNursery();
+	minorGCCount++;
+
+	usecs = microsecs() - usecs;
+	gcUSecs += usecs;
+#ifdef PROFILER
+	if (profiling) profileRecordGC(usecs);
+#endif
+	captureIncomingBytes();
+}
+
+static void reclaimSpace(int wordsNeeded) {
+	// Called when the free chunk has fewer than wordsNeeded words. Do a minor collection if
+	// possible, and a full one if that is not possible or does not leave enough free space.
+
+	if (!gcMarking && !rememberedOverflow && (freeChunk > nurseryStart)) {
+		minorGC();
+		int minFree = wordsNeeded + ((heapEnd - memStart) / 8); // avoid repeated minor collections
+		if (WORDS(freeChunk) >= minFree) return;
+	}
+	gc();
+}
+
+// Full Garbage Collection
+
+#ifndef GC_FRAGMENTATION_PERCENT
+  #define GC_FRAGMENTATION_PERCENT 25
+#endif
+
 void gc() {
 	// Perform a garbage collection to reclaim unused objects and compact memory.
+
+	collectGarbage(true);
+}
+
+static void collectGarbage(int mustCompact) {
+	// Reclaim unused objects. Compact memory if mustCompact is true or if the free space
+	// outside of the free chunk exceeds GC_FRAGMENTATION_PERCENT of the object heap.
 	// Call captureIncomingBytes() to avoid serial buffer overruns during garbage collection.
 
 	captureIncomingBytes();
@@ -495,15 +1152,33 @@ void gc() {
 	uint32 usecs = microsecs();
 
 	// assume: forwarding pointers cleared at end of compaction so no need to clear them here
-	markRoots();
-	sweep();
-	applyForwarding();
-	compact();
+	if (gcMarking) {
+		finishMarking();
+	} else {
+		markedWords = 0;
+		markRoots();
+	}
+	int holeWords = (freeChunk - memStart) - markedWords; // free words below the free chunk
+	if (mustCompact || ((100 * holeWords) > (GC_FRAGMENTATION_PERCENT * (heapEnd - memStart)))) {
+		sweep((OBJ) objstore + 1);
+		forwardRoots();
+		compact((OBJ) objstore + 1);
+		clearFreeLists();
+	} else {
+		sweepToFreeLists();
+	}
+	resetNursery();
+	majorGCCount++;
+	freeWordsAfterGC = WORDS(freeChunk);
 
 	usecs = microsecs() - usecs;
+	gcUSecs += usecs;
+#ifdef PROFILER
+	if (profiling) profileRecordGC(usecs);
+#endif
 
 	char s[100];
-	sprintf(s, "GC took %d usecs; free %d words", usecs, WORDS(freeChunk) - 2);
+	sprintf(s, "GC took %d usecs; free %d words", usecs, wordsFree());
 	outputString(s);
 
 	captureIncomingBytes();
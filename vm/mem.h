@@ -75,7 +75,9 @@ typedef int * OBJ;
 #define IntegerType 2
 #define ByteArrayType 3
 #define StringType 4
-// types 5-7 reserved for future non-pointer objects
+#define Int16ArrayType 5 // types 5-7 are packed arrays (see below)
+#define Int32ArrayType 6
+#define Float32ArrayType 7
 #define BinaryObjectTypes 7 // objects with type ID's <= 7 do not contain pointers
 #define ArrayType 8
 #define ListType 9
@@ -123,11 +125,30 @@ static inline int objWords(OBJ obj) {
 #define BYTES(obj) (4 * WORDS(obj) - BYTECOUNT_ADJUST(obj))
 
 static inline void setByteCountAdjust(OBJ obj, int byteCount) {
-	if (isInt(obj) || isBoolean(obj) || (ByteArrayType != TYPE(obj))) return;
+	if (isInt(obj) || isBoolean(obj)) return;
+	if ((ByteArrayType != TYPE(obj)) && (Int16ArrayType != TYPE(obj))) return;
 	int delta = 4 - (byteCount & 3); // # of bytes to subtract from 4 * WORDS(obj)
 	*obj = ((delta & 3) << 29) | ((*obj) & 0x9FFFFFFF);
 }
 
+// String Builders
+//
+// A string builder is a string with room to grow. Its header has STRING_BUILDER_FLAG set
+// and its last word holds its length in bytes. Since that word follows the null terminator,
+// a string builder can be used wherever a string is expected. Joining onto a string builder
+// appends to it in place and returns it. When it is full, it is first grown to twice its
+// capacity with resizeObj(), so building a string from n pieces takes O(n) time, not O(n^2),
+// and every reference to the builder sees the appended bytes.
+// A string builder is modified in place, so primitives that would otherwise return an
+// unmodified string argument return a copy of a string builder.
+
+#define STRING_BUILDER_FLAG 0x10000000
+#define IS_STRING_BUILDER(obj) (IS_TYPE(obj, StringType) && (*((uint32 *) (obj)) & STRING_BUILDER_FLAG))
+
+static inline int stringBuilderCapacity(OBJ obj) { return (4 * (WORDS(obj) - 1)) - 1; }
+static inline int stringBuilderLength(OBJ obj) { return ((uint32 *) obj)[WORDS(obj)]; }
+static inline void setStringBuilderLength(OBJ obj, int byteCount) { ((uint32 *) obj)[WORDS(obj)] = byteCount; }
+
 // Types
 
 static inline int objType(OBJ obj) {
@@ -145,10 +166,89 @@ static inline int objType(OBJ obj) {
 
 #define FIELD(obj, i) (((OBJ *) obj)[HEADER_WORDS + (i)])
 
+// Packed Arrays
+//
+// Int16Array, Int32Array, and Float32Array objects store numbers without tags. They take
+// half (Int16Array) or the same space as a list of the same size, and since they contain
+// no pointers, the garbage collector does not scan them. Like a ByteArray, an Int16Array
+// uses BYTECOUNT_ADJUST to record an odd item count. The VM has no floating point values,
+// so Float32Array items are rounded to the nearest integer when they are read.
+
+#define IS_PACKED_ARRAY(obj) (!isInt(obj) && !isBoolean(obj) && \
+	(TYPE(obj) >= Int16ArrayType) && (TYPE(obj) <= Float32ArrayType))
+
+static inline int packedArrayCount(OBJ obj) {
+	return (Int16ArrayType == TYPE(obj)) ? (BYTES(obj) / 2) : WORDS(obj);
+}
+
+static inline int packedArrayAt(OBJ obj, int i) {
+	// Return the ith (zero-based) item of the given packed array.
+
+	switch (TYPE(obj)) {
+	case Int16ArrayType:
+		return ((int16 *) &FIELD(obj, 0))[i];
+	case Float32ArrayType: {
+		float f = ((float *) &FIELD(obj, 0))[i];
+		return (int) ((f < 0) ? (f - 0.5f) : (f + 0.5f));
+	}
+	default:
+		return ((int *) &FIELD(obj, 0))[i];
+	}
+}
+
+static inline int packedArrayAtPut(OBJ obj, int i, int value) {
+	// Store value as the ith (zero-based) item of the given packed array.
+	// Return false if value is out of range for an Int16Array.
+
+	switch (TYPE(obj)) {
+	case Int16ArrayType:
+		if ((value < -32768) || (value > 32767)) return false;
+		((int16 *) &FIELD(obj, 0))[i] = value;
+		break;
+	case Float32ArrayType:
+		((float *) &FIELD(obj, 0))[i] = (float) value;
+		break;
+	default:
+		((int *) &FIELD(obj, 0))[i] = value;
+	}
+	return true;
+}
+
+// Read-Only Strings
+//
+// String literals live in code chunks, outside the object store. They have the same layout
+// as strings in the object store, so they can be used wherever a string is expected, and
+// they never move. The garbage collector ignores references to them. Strings are never
+// modified in place, so primitives can return a string argument (including a read-only
+// string) instead of a copy of it. A read-only object must never be modified or resized.
+
+int isReadOnly(OBJ obj);
+
 // Global temporary GC root for use by primitives that do multiple allocations.
 
 extern OBJ tempGCRoot;
 
+// Incremental and Generational Garbage Collection
+//
+// WRITE_BARRIER(obj, value) must be called before storing value into a field of obj, an
+// existing object. It is not needed when storing into a newly allocated object, but an object
+// stops being new as soon as another allocation is done, since that allocation may trigger a
+// garbage collection that promotes it. For example, a primitive that fills tempGCRoot with
+// newly allocated strings must use WRITE_BARRIER() for each one.
+
+extern int gcMarking;
+extern int gcPauseUSecs;
+extern OBJ nurseryStart;
+extern int minorGCCount;
+extern int majorGCCount;
+
+void gcStep(void);
+void gcWriteBarrier(OBJ obj, OBJ value);
+
+#define WRITE_BARRIER(obj, value) { \
+	if (gcMarking || ((OBJ) (value) >= nurseryStart)) gcWriteBarrier((obj), (value)); \
+}
+
 // Object Memory Operations
 
 void memInit();
@@ -159,9 +259,26 @@ void gc();
 OBJ newObj(int typeID, int wordCount, OBJ fill);
 OBJ resizeObj(OBJ obj, int wordCount);
 OBJ newString(int byteCount);
+OBJ newPackedArray(int typeID, int count);
 OBJ newStringFromBytes(const char *bytes, int byteCount);
+OBJ newStringBuilder(int capacity);
 char* obj2str(OBJ obj);
 
+// Heap Statistics
+
+typedef struct {
+	int objectCounts[16]; // number of objects of each type ID
+	int objectWords[16]; // words used by objects of each type ID, including headers
+	int freeWords;
+	int largestFreeChunk;
+	int fragmentation; // percent of free words outside the largest free chunk
+	int gcCount; // minor plus full garbage collections
+	int gcMSecs; // total garbage collection time
+} HeapStats;
+
+void getHeapStats(HeapStats *stats);
+void reportHeapStats(void);
+
 // Debugging Support
 
 void reportNum(const char *msg, int n);
@@ -648,16 +648,19 @@ static OBJ primWebSocketLastEvent(int argCount, OBJ *args) {
 		FIELD(tempGCRoot, 0) = int2obj(3);
 		FIELD(tempGCRoot, 1) = int2obj(websocketEvtType);
 		FIELD(tempGCRoot, 2) = int2obj(websocketClientId);
+		// allocate the payload before storing it; the allocation may move tempGCRoot
+		OBJ payload;
 		if (WStype_TEXT == websocketEvtType) {
-			FIELD(tempGCRoot, 3) = newStringFromBytes(websocketPayload, websocketPayloadLength);
+			payload = newStringFromBytes(websocketPayload, websocketPayloadLength);
 		} else {
 			int wordCount = (websocketPayloadLength + 3) / 4;
-			FIELD(tempGCRoot, 3) = newObj(ByteArrayType, wordCount, falseObj);
-			OBJ payload = FIELD(tempGCRoot, 3);
+			payload = newObj(ByteArrayType, wordCount, falseObj);
 			if (!payload) return fail(insufficientMemoryError);
 			memcpy(&FIELD(payload, 0), websocketPayload, websocketPayloadLength);
 			setByteCountAdjust(payload, websocketPayloadLength);
 		}
+		WRITE_BARRIER(tempGCRoot, payload);
+		FIELD(tempGCRoot, 3) = payload;
 		websocketEvtType = -1;
 		return tempGCRoot;
 	} else {
@@ -892,18 +895,23 @@ static OBJ primMQTTLastEvent(int argCount, OBJ *args) {
 		if (!tempGCRoot) return tempGCRoot; // allocation failed
 
 		FIELD(tempGCRoot, 0) = int2obj(2); //list size
-		FIELD(tempGCRoot, 1) = newStringFromBytes(lastMQTTTopic, strlen(lastMQTTTopic));
+		// allocate each item before storing it; the allocation may move tempGCRoot
+		OBJ topic = newStringFromBytes(lastMQTTTopic, strlen(lastMQTTTopic));
+		WRITE_BARRIER(tempGCRoot, topic);
+		FIELD(tempGCRoot, 1) = topic;
 
+		OBJ payload;
 		if (useBinary) {
 			int wordCount = (payloadByteCount + 3) / 4;
-			OBJ payload = newObj(ByteArrayType, wordCount, falseObj);
+			payload = newObj(ByteArrayType, wordCount, falseObj);
 			if (!payload) return fail(insufficientMemoryError);
 			memcpy(&FIELD(payload, 0), lastMQTTPayload, payloadByteCount);
 			setByteCountAdjust(payload, payloadByteCount);
-			FIELD(tempGCRoot, 2) = payload;
 		} else {
-			FIELD(tempGCRoot, 2) = newStringFromBytes(lastMQTTPayload, strlen(lastMQTTPayload));
+			payload = newStringFromBytes(lastMQTTPayload, strlen(lastMQTTPayload));
 		}
+		WRITE_BARRIER(tempGCRoot, payload);
+		FIELD(tempGCRoot, 2) = payload;
 
 		hasMQTTMessage = false;
 		return tempGCRoot;
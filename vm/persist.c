@@ -22,6 +22,7 @@
 //		void flashWriteData(int *dst, int wordCount, uint8 *src)
 //		void flashWriteWord(int *addr, int value)
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,7 +31,11 @@
 #include "interp.h"
 #include "persist.h"
 
+#if defined(GNUBLOCKS) && !defined(EMSCRIPTEN)
+#include "../linux+pi/linux.h"
+#else
 void delay(unsigned long); // Arduino delay function
+#endif
 
 #if defined(ARDUINO_ARCH_ESP32)
   // use Flash codestore on all ESP32 variants
@@ -728,7 +733,7 @@ static void updateChunkTable() {
 	int *p = compactionStartRecord();
 	while (p) {
 		int recType = (*p >> 16) & 0xFF;
-		if (chunkCode == recType) {
+		if ((chunkCode == recType) || (chunkCodeCompact == recType)) {
 			int chunkIndex = (*p >> 8) & 0xFF;
 			if (chunkIndex < MAX_CHUNKS) {
 				chunks[chunkIndex].chunkType = *p & 0xFF;
@@ -745,111 +750,105 @@ static void updateChunkTable() {
 		p = recordAfter(p);
 	}
 
+	// compute the CRCs of the latest versions of the chunks
+	for (int i = 0; i < MAX_CHUNKS; i++) {
+		if (chunks[i].code) chunks[i].crc = chunkCRC(chunks[i].code);
+	}
+
 	// update code pointers for tasks
 	for (int i = 0; i < MAX_TASKS; i++) {
 		if (tasks[i].status) { // task entry is in use
 			tasks[i].code = chunks[tasks[i].taskChunkIndex].code;
 		}
 	}
-}
-
-// Flash Compaction
-
-#ifndef RAM_CODE_STORE
 
-static char chunkProcessed[256];
-static char varProcessed[256];
+	primCacheRebuild(); // chunks may have moved
+	clearCalleeCache();
+}
 
-static int * copyChunkInfo(int id, int *src, int *dst) {
-	// Copy the most recent data about the chunk with the given ID to dst and return
-	// the new dst pointer. If the given chunk id has been processed do nothing.
+// Compaction Index
+//
+// Compaction keeps the most recent code record of each chunk, unless the chunk was deleted
+// after it, and the most recent name record of each variable, unless all variables were
+// cleared after it. buildCompactionIndex() finds those records in a single pass, so
+// compaction takes time linear in the number of records. Index entries are word offsets
+// from the start of the current half-space, or zero if there is no record. 16-bit offsets
+// are enough for half-spaces of up to 256k bytes.
 
-	if (chunkProcessed[id]) return dst;
+static uint16 latestChunkRecord[256];
+static uint16 latestVarRecord[256];
 
-	int *chunkSrc = 0;
+_Static_assert(HALF_SPACE <= (4 * 0xFFFF), "HALF_SPACE is too large for 16-bit compaction index offsets");
 
-	// scan rest of the records to get the most recent info about this chunk
-	while (src) {
-		if (id == ((*src >> 8) & 0xFF)) { // id field matches
-			int type = (*src >> 16) & 0xFF;
-			switch (type) {
-			case chunkCode:
-				chunkSrc = src;
-				break;
-			case chunkDeleted:
-				chunkSrc = 0;
-				break;
-			}
+static void buildCompactionIndex(int *firstRecord) {
+	int *start = (0 == current) ? start0 : start1;
+	memset(latestChunkRecord, 0, sizeof(latestChunkRecord));
+	memset(latestVarRecord, 0, sizeof(latestVarRecord));
+
+	for (int *rec = firstRecord; rec; rec = recordAfter(rec)) {
+		int type = (*rec >> 16) & 0xFF;
+		int id = (*rec >> 8) & 0xFF;
+		if ((chunkCode == type) || (chunkCodeCompact == type) || (chunkDeleted == type)) {
+			latestChunkRecord[id] = rec - start;
+		} else if (varName == type) {
+			latestVarRecord[id] = rec - start;
+		} else if (varsClearAll == type) {
+			memset(latestVarRecord, 0, sizeof(latestVarRecord));
 		}
-		src = recordAfter(src);
-	}
-	if (chunkSrc) {
-		dst = copyChunk(dst, chunkSrc);
 	}
-	chunkProcessed[id] = true;
-	return dst;
 }
 
-static int * copyVarInfo(int id, int *src, int *dst) {
-	if (varProcessed[id]) return dst;
+static int keepRecord(int *rec) {
+	// Return true if the given record survives compaction. Call buildCompactionIndex() first.
 
-	// record info from first reference to this variable
-	int type = (*src >> 16) & 0xFF;
-	int *nameRec = (varName == type) ? src : NULL;
+	int offset = rec - ((0 == current) ? start0 : start1);
+	int type = (*rec >> 16) & 0xFF;
+	int id = (*rec >> 8) & 0xFF;
+	if ((chunkCode == type) || (chunkCodeCompact == type)) return (latestChunkRecord[id] == offset);
+	if (varName == type) return (latestVarRecord[id] == offset);
+	return false;
+}
 
-	// scan rest of the records to get the most recent info about this variable
-	while (src) {
-		int type = (*src >> 16) & 0xFF;
-		switch (type) {
-		case varName:
-			if (id == ((*src >> 8) & 0xFF)) nameRec = src;
-			break;
-		case varsClearAll:
-			nameRec = NULL;
-			break;
-		}
-		src = recordAfter(src);
-	}
-	if (nameRec) dst = copyChunk(dst, nameRec);
-	varProcessed[id] = true;
-	return dst;
+static int codeStoreBytesUsed() {
+	return 4 * (freeStart - ((0 == current) ? start0 : start1));
+}
+
+static void reportCompaction(const char *storeName, uint32 startT, int bytesBefore) {
+	char s[150];
+	int used = codeStoreBytesUsed();
+	sprintf(s, "Compacted %s code store (%d msecs, %d bytes reclaimed)\n%d bytes used (%d%%) of %d",
+		storeName, (int) (millisecs() - startT), bytesBefore - used,
+		used, (100 * used) / HALF_SPACE, HALF_SPACE);
+	outputString(s);
 }
 
+// Flash Compaction
+
+#ifndef RAM_CODE_STORE
+
 static void compactFlash() {
 	// Copy only the most recent chunk and variable records to the other half-space.
 	// Details:
 	//	1. erase the other half-space
-	//	2. clear the chunk and variable processed flags
-	//	3. find the start point for the scan (half space start or after latest 'deleteAll' record)
-	//	4. for each chunk and variable record in the current half-space
-	//		a. if the chunk or variable has been processed, skip it
-	//		b. gather the most recent information about that chunk or variable
-	//		c. copy that information into the other half-space
-	//		d. mark the chunk or variable as processed
+	//	2. find the start point for the scan (half space start or after latest 'deleteAll' record)
+	//	3. index the records to keep (see buildCompactionIndex())
+	//	4. copy the records to keep into the other half-space, preserving their order
 	//	5. switch to the other half-space
 	//	6. remember the free pointer for the new half-space
 
 	uint32_t startT = millisecs();
-
-	// clear the processed flags
-	memset(chunkProcessed, 0, sizeof(chunkProcessed));
-	memset(varProcessed, 0, sizeof(varProcessed));
+	int bytesBefore = codeStoreBytesUsed();
+	copyBroadcastLiteral(); // literals may move
 
 	// clear the destination half-space and init dst pointer
 	clearHalfSpace(!current);
 	int *dst = ((0 == !current) ? start0 : start1) + 1;
 
 	int *src = compactionStartRecord();
+	buildCompactionIndex(src);
 	while (src) {
 		captureIncomingBytes();
-		int header = *src;
-		int type = (header >> 16) & 0xFF;
-		int id = (header >> 8) & 0xFF;
-		if ((chunkCode <= type) && (type <= chunkDeleted)) {
-			dst = copyChunkInfo(id, src, dst);
-		} else if ((varName <= type) && (type <= varsClearAll)) {
-			dst = copyVarInfo(id, src, dst);
-		}
+		if (keepRecord(src)) dst = copyChunk(dst, src);
 		src = recordAfter(src);
 	}
 
@@ -865,33 +864,59 @@ static void compactFlash() {
 		restartSerial();
 	#endif
 
-	char s[100];
-	int bytesUsed = 4 * (freeStart - ((0 == current) ? start0 : start1));
-	sprintf(s, "Compacted Flash code store (%lu msecs)\n%d bytes used (%d%%) of %d",
-		millisecs() - startT,
-		bytesUsed, (100 * bytesUsed) / HALF_SPACE, HALF_SPACE);
-	outputString(s);
+	reportCompaction("Flash", startT, bytesBefore);
 }
 
 #endif // compactFlash
 
-// RAM compaction
+// Code File Support
 
-#ifdef RAM_CODE_STORE
+#if USE_CODE_FILE
+
+static void rewriteCodeFile() {
+	// Replace the contents of the code file with the contents of the RAM code store.
+
+	clearCodeFile(cycleCount(current));
+	int *codeStart = ((0 == current) ? start0 : start1) + 1; // skip half-space header
+	writeCodeFile((uint8 *) codeStart, 4 * (freeStart - codeStart));
+	syncCodeFile();
+}
 
-static int keepCodeChunk(int id, int header, int *start) {
-	// Return true if this code chunk should be kept when compacting RAM.
+static void removeIncompleteRecords(int codeFileBytes) {
+	// Called at startup after reading the code file into the RAM code store. If the board was
+	// reset or lost power while records were being written to the code file, the file may end
+	// with an incomplete record. If so, truncate the code store and the code file after the
+	// last complete record. Do nothing if the file is empty or holds only the half-space header.
 
-	if (unusedChunk == chunks[id].chunkType) return false; // code chunk was deleted
+	if (codeFileBytes <= 4) return; // no records
 
-	int *rec = start;
-	while (rec) {
-		if (*rec == header) return false; // superceded
-		rec = recordAfter(rec);
+	int *start = (0 == current) ? start0 : start1;
+	int *fileEnd = start + (codeFileBytes / 4);
+	int *p = start + 1; // skip half-space header
+	while ((p + PERSISTENT_HEADER_WORDS) <= fileEnd) {
+		if ('R' != ((*p >> 24) & 0xFF)) break; // bad header
+		int *next = p + PERSISTENT_HEADER_WORDS + *(p + 1);
+		if ((next <= p) || (next > fileEnd)) break; // bad word count or incomplete record
+		p = next;
 	}
-	return true;
+	if ((4 * (p - start)) >= codeFileBytes) return; // all records are complete
+
+	char s[100];
+	sprintf(s, "Removed %d bytes of incomplete records from code file", codeFileBytes - (4 * (p - start)));
+	outputString(s);
+
+	freeStart = p;
+	if (fileEnd > freeStart) memset(freeStart, 0, 4 * (fileEnd - freeStart));
+	setCycleCount(current, cycleCount(current)); // rewrite header in case it was damaged
+	rewriteCodeFile();
 }
 
+#endif
+
+// RAM compaction
+
+#ifdef RAM_CODE_STORE
+
 static void compactRAM(int printStats) {
 	// Compact a RAM-based code store in place. In-place compaction is possible in RAM since,
 	// unlike Flash memory, RAM can be re-written without first erasing it. This approach
@@ -905,16 +930,17 @@ static void compactRAM(int printStats) {
 	//
 	// Details:
 	//	1. find the start point for the scan (half space start or after latest 'deleteAll' record)
-	//	2. find the most recent "varsClearAll" record
-	//	3. for each chunk and variable record in the current half-space
-	//		a. deterimine if the record should be kept or skipped
-	//		b. if kept, copy the record down to the destination pointer
+	//	2. index the records to keep (see buildCompactionIndex())
+	//	3. for each record in the current half-space, if it is to be kept,
+	//	   copy it down to the destination pointer
 	//	4. update the free pointer
 	//	5. clear the rest of the code store
 	//	6. update the compaction count
 	//	7. re-write the code file
 
 	uint32_t startT = millisecs();
+	int bytesBefore = codeStoreBytesUsed();
+	copyBroadcastLiteral(); // literals may move
 
 	int *dst = ((0 == !current) ? start0 : start1) + 1;
 	int *src = compactionStartRecord();
@@ -924,25 +950,10 @@ static void compactRAM(int printStats) {
 		return;
 	}
 
-	// find the most recent varsClearAll record
-	int *varsStart = src;
-	int *rec = src;
-	while (rec) {
-		if (varsClearAll == ((*rec >> 16) & 0xFF)) varsStart = rec;
-		rec = recordAfter(rec);
-	}
-
+	buildCompactionIndex(src);
 	while (src) {
-		int *next = recordAfter(src);
-		int header = *src;
-		int type = (header >> 16) & 0xFF;
-		int id = (header >> 8) & 0xFF;
-		if ((type == chunkCode) && keepCodeChunk(id, header, next)) {
-			dst = copyChunk(dst, src);
-		} else if ((varName == type) && (src >= varsStart)) {
-			dst = copyChunk(dst, src);
-		} else {
-		}
+		int *next = recordAfter(src); // find the next record before src is overwritten
+		if (keepRecord(src)) dst = copyChunk(dst, src);
 		src = next;
 	}
 
@@ -951,23 +962,12 @@ static void compactRAM(int printStats) {
 
 	updateChunkTable();
 
-	// re-write the code file
 	#if USE_CODE_FILE
 		setCycleCount(current, cycleCount(current) + 1);
-		clearCodeFile(cycleCount(current));
-		int *codeStart = ((0 == current) ? start0 : start1) + 1; // skip half-space header
-		writeCodeFile((uint8 *) codeStart, 4 * (freeStart - codeStart));
+		rewriteCodeFile();
 	#endif
 
-	if (printStats) {
-		char s[100];
-		int bytesUsed = 4 * (freeStart - ((0 == current) ? start0 : start1));
-
-		sprintf(s, "Compacted RAM code store (%lu msecs)\n%d bytes used (%d%%) of %d",
-			millisecs() - startT,
-			bytesUsed, (100 * bytesUsed) / HALF_SPACE, HALF_SPACE);
-		outputString(s);
-	}
+	if (printStats) reportCompaction("RAM", startT, bytesBefore);
 }
 #endif
 
@@ -980,6 +980,7 @@ int ramSize() { return 4 * (freeStart - start0); }
 // entry points
 
 void clearPersistentMemory() {
+	copyBroadcastLiteral(); // literals will be cleared
 	int c0 = cycleCount(0);
 	int c1 = cycleCount(1);
 	int count = (c0 > c1) ? c0 : c1;
@@ -1004,7 +1005,7 @@ int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, u
 		}
 	}
 	// write the record
-	int header = ('R' << 24) | ((recordType & 0xFF) << 16) | ((id & 0xFF) << 8) | (extra & 0xFF);
+	int header = PERSISTENT_HEADER(recordType, id, extra);
 
 // xxx debug: dump contents
 // char s[500];
@@ -1019,8 +1020,8 @@ int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, u
 
 	#if USE_CODE_FILE
 		if (!suspendFileUpdates) {
-			writeCodeFileWord(header);
-			writeCodeFileWord(wordCount);
+			int recordHeader[PERSISTENT_HEADER_WORDS] = { header, wordCount };
+			writeCodeFile((uint8 *) recordHeader, sizeof(recordHeader));
 			writeCodeFile(data, 4 * wordCount);
 		}
 	#endif
@@ -1033,6 +1034,33 @@ int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, u
 	return result;
 }
 
+int * appendPersistentRecords(int *records, int wordCount) {
+	// Append a sequence of complete records (including their header words) at the end of the
+	// current half-space with a single write and return the address of the first record.
+	// Used to commit a batch of code chunks. Perform a compaction if necessary.
+	int *end = (0 == current) ? end0 : end1;
+	if ((freeStart + wordCount) > end) {
+		compactCodeStore();
+		end = (0 == current) ? end0 : end1;
+		if ((freeStart + wordCount) > end) {
+			outputString("Not enough room even after compaction");
+			return NULL;
+		}
+	}
+
+	#if USE_CODE_FILE
+		if (!suspendFileUpdates) {
+			writeCodeFile((uint8 *) records, 4 * wordCount);
+			syncCodeFile();
+		}
+	#endif
+
+	int *result = freeStart;
+	flashWriteData(freeStart, wordCount, (uint8 *) records);
+	freeStart += wordCount;
+	return result;
+}
+
 void compactCodeStore() {
 	#ifdef RAM_CODE_STORE
 		compactRAM(true);
@@ -1041,6 +1069,15 @@ void compactCodeStore() {
 	#endif
 }
 
+void syncCodeStore() {
+	// Make sure that all records appended so far will survive a reset. Called at sync points
+	// such as when the IDE is idle.
+
+	#if USE_CODE_FILE
+		syncCodeFile();
+	#endif
+}
+
 void restoreScripts() {
 	initPersistentMemory();
 
@@ -1048,6 +1085,7 @@ void restoreScripts() {
 		int codeFileBytes = initCodeFile(flash, HALF_SPACE);
 		int *start = current ? start1 : start0;
 		freeStart = start + (codeFileBytes / 4);
+		removeIncompleteRecords(codeFileBytes);
 	#elif defined(ARDUINO_ARCH_ESP32)
 		initFileSystem();
 	#endif
@@ -21,11 +21,14 @@ extern "C" {
 // Not all record types use the <extra> header field.
 
 #define PERSISTENT_HEADER_WORDS 2
+#define PERSISTENT_HEADER(recordType, id, extra) \
+	(('R' << 24) | (((recordType) & 0xFF) << 16) | (((id) & 0xFF) << 8) | ((extra) & 0xFF))
 
 typedef enum {
 	chunkCode32bit = 10, // deprecated
 	chunkAttribute = 11, // deprecated
 	chunkCode = 12, // 16-bit code chunk
+	chunkCodeCompact = 13, // 16-bit code chunk without decompiler metadata; last word is its CRC
 	chunkDeleted = 19,
 	varName = 21,
 	varsClearAll = 29,
@@ -35,11 +38,13 @@ typedef enum {
 // Persistent Memory Operations
 
 int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, uint8 *data);
+int * appendPersistentRecords(int *records, int wordCount);
 void clearPersistentMemory();
 int * recordAfter(int *lastRecord);
 void restoreScripts();
 int *scanStart();
 void compactCodeStore();
+void syncCodeStore();
 
 #ifdef EMSCRIPTEN
 int *ramStart();
@@ -52,6 +57,7 @@ int initCodeFile(uint8 *flash, int flashByteCount);
 void initFileSystem();
 void writeCodeFile(uint8 *code, int byteCount);
 void writeCodeFileWord(int word);
+void syncCodeFile();
 void clearCodeFile(int cycleCount);
 
 // File operations for storing system state
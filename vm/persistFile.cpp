@@ -18,7 +18,21 @@
 
 #define FILE_NAME "/ublockscode"
 
+// Code File Writer
+//
+// Records are appended to the code file through a RAM buffer, so appending a record does not
+// close, reopen, or seek the file. The buffer is written to the file when it is full and at
+// sync points (see syncCodeFile()): when a batch of chunks is committed, when the code file
+// is rewritten after a compaction, and when the IDE has been idle for half a second. Records
+// still in the buffer when the board is reset or loses power are lost; a record that was only
+// partly written is removed by restoreScripts() at startup.
+
+#define CODE_FILE_BUF_SIZE 1024
+
 static File codeFile;
+static uint8 codeFileBuf[CODE_FILE_BUF_SIZE];
+static int codeFileBufCount = 0;
+static int codeFileDirty = false; // true if the file has changed since the last sync
 
 static void closeAndOpenCodeFile() {
 	if (codeFile) codeFile.close();
@@ -26,6 +40,11 @@ static void closeAndOpenCodeFile() {
 	codeFile.seek(0, SeekEnd);
 }
 
+static void writeCodeFileBuffer() {
+	if (codeFile && codeFileBufCount) codeFile.write(codeFileBuf, codeFileBufCount);
+	codeFileBufCount = 0;
+}
+
 extern "C" void initFileSystem() {
 	// Initialize the file system.
 
@@ -50,20 +69,40 @@ extern "C" int initCodeFile(uint8 *flash, int flashByteCount) {
 }
 
 extern "C" void writeCodeFile(uint8 *code, int byteCount) {
-	if (codeFile) codeFile.write(code, byteCount);
-	closeAndOpenCodeFile();
+	if (!codeFile) return;
+	codeFileDirty = true;
+	if ((codeFileBufCount + byteCount) > CODE_FILE_BUF_SIZE) {
+		writeCodeFileBuffer();
+		if (byteCount > CODE_FILE_BUF_SIZE) { // too large to buffer; write directly
+			codeFile.write(code, byteCount);
+			return;
+		}
+	}
+	memcpy(&codeFileBuf[codeFileBufCount], code, byteCount);
+	codeFileBufCount += byteCount;
 }
 
 extern "C" void writeCodeFileWord(int word) {
-	if (codeFile) codeFile.write((uint8 *) &word, 4);
+	writeCodeFile((uint8 *) &word, 4);
+}
+
+extern "C" void syncCodeFile() {
+	// Write any buffered records to the code file and flush the file to Flash memory.
+
+	if (!codeFileDirty) return;
+	writeCodeFileBuffer();
+	if (codeFile) codeFile.flush();
+	codeFileDirty = false;
 }
 
 extern "C" void clearCodeFile(int cycleCount) {
+	codeFileBufCount = 0; // discard buffered records
 	if (codeFile) codeFile.close();
 	codeFile = myFS.open(FILE_NAME, "w"); // truncate file to zero length
 	int headerWord = ('S' << 24) | cycleCount; // Header record, version 1
-	writeCodeFileWord(headerWord);
+	codeFile.write((uint8 *) &headerWord, 4);
 	closeAndOpenCodeFile();
+	codeFileDirty = false;
 }
 
 // File operations for storing system state
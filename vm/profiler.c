@@ -0,0 +1,227 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2026 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// profiler.c - Optional interpreter profiler
+
+// The profiler is included only when the VM is compiled with -DPROFILER.
+// While profiling is on, it counts opcode dispatches per chunk and per opcode, and it
+// records the number of calls and the time spent in each named primitive, in garbage
+// collection, and in processing messages from the IDE, as well as the number of words
+// allocated by each allocation site (the chunk and instruction that was running when
+// the allocation was made). The IDE turns profiling on and off
+// and requests the results with profileMsg. The results are sent as a series of
+// profileDataMsg messages, ending with a summary record.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mem.h"
+#include "interp.h"
+
+#ifdef PROFILER
+
+// Profile record types (sent in the chunkID field of profileDataMsg)
+
+#define profileSummary		0
+#define profileChunk		1
+#define profileOpcode		2
+#define profilePrimitive	3
+#define profileAllocSite	4
+
+#define PROFILE_PRIM_COUNT 48
+#define PROFILE_NAME_SIZE 32
+#define PROFILE_SITE_COUNT 32
+
+typedef struct {
+	PrimitiveFunction f;
+	uint32 calls;
+	uint32 usecs;
+	uint8 setIndex;
+	char primName[PROFILE_NAME_SIZE];
+} ProfilePrimRecord;
+
+typedef struct {
+	uint32 calls;
+	uint32 words;
+	uint16 ip;
+	uint8 chunkIndex;
+} ProfileSiteRecord;
+
+int profiling = false;
+uint32 profileChunkCounts[MAX_CHUNKS];
+uint32 profileOpCounts[128];
+uint32 profileAllocatedWords = 0;
+uint32 profileGCCount = 0;
+uint32 profileGCUSecs = 0;
+uint8 profileSiteChunk = 0;
+uint16 profileSiteIP = 0;
+
+static ProfilePrimRecord profilePrims[PROFILE_PRIM_COUNT];
+static int profilePrimCount = 0;
+
+static ProfileSiteRecord profileSites[PROFILE_SITE_COUNT];
+static int profileSiteCount = 0;
+
+static uint32 profileStartUSecs = 0;
+static uint32 profileElapsedUSecs = 0;
+static uint32 msgCount = 0;
+static uint32 msgUSecs = 0;
+
+static void clearProfile() {
+	memset(profileChunkCounts, 0, sizeof(profileChunkCounts));
+	memset(profileOpCounts, 0, sizeof(profileOpCounts));
+	memset(profilePrims, 0, sizeof(profilePrims));
+	profilePrimCount = 0;
+	memset(profileSites, 0, sizeof(profileSites));
+	profileSiteCount = 0;
+	profileElapsedUSecs = 0;
+	profileAllocatedWords = 0;
+	profileGCCount = profileGCUSecs = 0;
+	msgCount = msgUSecs = 0;
+}
+
+// Recording
+
+void profileRecordPrimitive(int setIndex, const char *primName, PrimitiveFunction f, uint32 usecs) {
+	// Record a call to a named primitive. Primitives beyond the first PROFILE_PRIM_COUNT
+	// distinct primitives called while profiling are not recorded.
+
+	ProfilePrimRecord *rec = NULL;
+	for (int i = 0; i < profilePrimCount; i++) {
+		if (profilePrims[i].f == f) {
+			rec = &profilePrims[i];
+			break;
+		}
+	}
+	if (!rec) {
+		if (profilePrimCount >= PROFILE_PRIM_COUNT) return; // table full
+		rec = &profilePrims[profilePrimCount++];
+		rec->f = f;
+		rec->setIndex = setIndex;
+		strncpy(rec->primName, primName, PROFILE_NAME_SIZE - 1);
+	}
+	rec->calls++;
+	rec->usecs += usecs;
+}
+
+void profileRecordAllocation(uint32 words) {
+	// Record an allocation at the current allocation site, the instruction most recently
+	// dispatched. Sites beyond the first PROFILE_SITE_COUNT distinct sites are not recorded.
+
+	profileAllocatedWords += words;
+	ProfileSiteRecord *rec = NULL;
+	for (int i = 0; i < profileSiteCount; i++) {
+		if ((profileSites[i].ip == profileSiteIP) && (profileSites[i].chunkIndex == profileSiteChunk)) {
+			rec = &profileSites[i];
+			break;
+		}
+	}
+	if (!rec) {
+		if (profileSiteCount >= PROFILE_SITE_COUNT) return; // table full
+		rec = &profileSites[profileSiteCount++];
+		rec->chunkIndex = profileSiteChunk;
+		rec->ip = profileSiteIP;
+	}
+	rec->calls++;
+	rec->words += words;
+}
+
+void profileRecordGC(uint32 usecs) {
+	profileGCCount++;
+	profileGCUSecs += usecs;
+}
+
+void profileRecordMessage(uint32 usecs) {
+	msgCount++;
+	msgUSecs += usecs;
+}
+
+// Reporting
+
+static int putUInt32(char *dst, uint32 n) {
+	// Store n in dst, least significant byte first. Return the number of bytes stored.
+
+	dst[0] = n & 0xFF;
+	dst[1] = (n >> 8) & 0xFF;
+	dst[2] = (n >> 16) & 0xFF;
+	dst[3] = (n >> 24) & 0xFF;
+	return 4;
+}
+
+static void sendProfileData() {
+	char buf[64];
+	int n;
+
+	uint32 elapsed = profileElapsedUSecs;
+	if (profiling) elapsed += microsecs() - profileStartUSecs;
+
+	for (int i = 0; i < MAX_CHUNKS; i++) {
+		if (profileChunkCounts[i]) {
+			buf[0] = i;
+			n = 1 + putUInt32(&buf[1], profileChunkCounts[i]);
+			waitAndSendMessage(profileDataMsg, profileChunk, n, buf);
+		}
+	}
+	for (int i = 0; i < 128; i++) {
+		if (profileOpCounts[i]) {
+			buf[0] = i;
+			n = 1 + putUInt32(&buf[1], profileOpCounts[i]);
+			waitAndSendMessage(profileDataMsg, profileOpcode, n, buf);
+		}
+	}
+	for (int i = 0; i < profilePrimCount; i++) {
+		ProfilePrimRecord *rec = &profilePrims[i];
+		buf[0] = rec->setIndex;
+		n = 1;
+		n += putUInt32(&buf[n], rec->calls);
+		n += putUInt32(&buf[n], rec->usecs);
+		int nameLen = strlen(rec->primName);
+		memcpy(&buf[n], rec->primName, nameLen);
+		n += nameLen;
+		waitAndSendMessage(profileDataMsg, profilePrimitive, n, buf);
+	}
+	for (int i = 0; i < profileSiteCount; i++) {
+		ProfileSiteRecord *rec = &profileSites[i];
+		buf[0] = rec->chunkIndex;
+		n = 1;
+		n += putUInt32(&buf[n], rec->ip);
+		n += putUInt32(&buf[n], rec->calls);
+		n += putUInt32(&buf[n], rec->words);
+		waitAndSendMessage(profileDataMsg, profileAllocSite, n, buf);
+	}
+
+	// the summary record is always sent last
+	n = putUInt32(buf, elapsed);
+	n += putUInt32(&buf[n], profileGCCount);
+	n += putUInt32(&buf[n], profileGCUSecs);
+	n += putUInt32(&buf[n], msgCount);
+	n += putUInt32(&buf[n], msgUSecs);
+	n += putUInt32(&buf[n], profileAllocatedWords);
+	waitAndSendMessage(profileDataMsg, profileSummary, n, buf);
+}
+
+void processProfileMsg(int op) {
+	// Handle a profileMsg from the IDE: 0 = stop, 1 = clear and start, 2 = send results.
+
+	if ((0 == op) && profiling) {
+		profileElapsedUSecs += microsecs() - profileStartUSecs;
+		profiling = false;
+	} else if (1 == op) {
+		clearProfile();
+		profileStartUSecs = microsecs();
+		profiling = true;
+	} else if (2 == op) {
+		sendProfileData();
+	}
+}
+
+#else
+
+void processProfileMsg(int op) {
+	outputString("Profiler not included in this VM (compile with -DPROFILER)");
+}
+
+#endif // PROFILER
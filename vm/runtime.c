@@ -24,7 +24,9 @@
 
 // Forward Reference Declarations
 
+#if !defined(GNUBLOCKS) || defined(EMSCRIPTEN)
 void delay(unsigned long); // Arduino delay function
+#endif
 
 static void softReset(int clearMemoryFlag);
 static void sendMessage(int msgType, int chunkIndex, int dataSize, char *data);
@@ -52,6 +54,42 @@ static void debugBeep(int count) {
 
 #endif
 
+// Selected Opcodes (see MicroBlocksCompiler.gp for complete set)
+
+#define pushLargeInteger 3
+#define pushHugeInteger 4
+#define pushLiteral 5
+#define initLocals 9
+#define jmp 22
+#define forLoop 27
+#define waitUntil 30
+#define callFunction 34
+#define commandPrimitive 36
+#define reporterPrimitive 37
+#define recvBroadcast 41
+#define codeEnd 127
+#define metadataTag 240
+
+int instructionWords(int16 *ip) {
+	// Return the number of 16-bit words used by the instruction at ip.
+
+	int op = CMD(*ip);
+	switch (op) {
+	case pushLargeInteger:
+	case pushLiteral:
+	case callFunction:
+	case commandPrimitive:
+	case reporterPrimitive:
+		return 2;
+	case pushHugeInteger:
+		return 3;
+	}
+	if ((jmp <= op) && (op <= waitUntil) && (op != forLoop)) { // jump instructions
+		return (0 == ARG(*ip)) ? 2 : 1; // zero arg means offset is in the next word
+	}
+	return 1;
+}
+
 // Named Primitive Support
 
 typedef struct {
@@ -107,25 +145,187 @@ PrimitiveFunction findPrimitive(char *primName) {
 	return NULL;
 }
 
-OBJ newPrimitiveCall(PrimitiveSetIndex setIndex, const char *primName, int argCount, OBJ *args) {
-	// Call a named primitive with the given primitive set index and name.
+static PrimitiveFunction findPrimitiveInSet(int setIndex, const char *primName) {
+	// Return the primitive with the given name in the given primitive set or NULL if not found.
 
+	if ((setIndex < 0) || (setIndex >= PrimitiveSetCount)) return NULL;
 	PrimEntry *entries = primSets[setIndex].entries;
 	int entryCount = primSets[setIndex].entryCount;
 	for (int i = 0; i < entryCount; i++) {
-		if (0 == strcmp(entries[i].primName, primName)) {
-			OBJ result = (entries[i].primFunc)(argCount, args); // call the primitive
-			tempGCRoot = NULL; // clear tempGCRoot in case it was used
-			return result;
+		if (0 == strcmp(entries[i].primName, primName)) return entries[i].primFunc;
+	}
+	return NULL;
+}
+
+// Primitive Cache
+//
+// Named primitive calls refer to the primitive by a primitive set index and a name string
+// stored as a literal in the code chunk. Since the address of that literal is fixed as long
+// as the chunk does not move, it can be used as a key in a small hash table that maps each
+// call site to its primitive function, avoiding the string comparisons on every call.
+//
+// The cache is filled when chunks are stored or restored and entries for call sites not yet
+// seen are added on their first call. The entries of a chunk are removed when that chunk is
+// replaced or deleted. The cache is rebuilt whenever chunks may have moved (e.g. after code
+// store compaction) and cleared when all code is deleted.
+
+#if defined(NRF51)
+	#define PRIM_CACHE_SIZE 32 // must be a power of 2
+#elif defined(ARDUINO_ARCH_SAMD) || defined(ESP8266)
+	#define PRIM_CACHE_SIZE 64 // must be a power of 2; limited RAM (32k or 80k)
+#else
+	#define PRIM_CACHE_SIZE 256 // must be a power of 2
+#endif
+#define PRIM_CACHE_PROBES 4
+
+typedef struct {
+	const char *primName; // address of the primitive name literal in a code chunk
+	PrimitiveFunction primFunc;
+	int setIndex;
+} PrimCacheEntry;
+
+static PrimCacheEntry primCache[PRIM_CACHE_SIZE];
+static int primCacheCount = 0;
+static uint32 primCacheHits = 0;
+static uint32 primCacheMisses = 0;
+
+#define PRIM_CACHE_HASH(setIndex, primName) \
+	(((((size_t) (primName)) >> 2) ^ (setIndex)) & (PRIM_CACHE_SIZE - 1))
+
+static inline PrimitiveFunction primCacheLookup(int setIndex, const char *primName) {
+	int i = PRIM_CACHE_HASH(setIndex, primName);
+	for (int probe = 0; probe < PRIM_CACHE_PROBES; probe++) {
+		PrimCacheEntry *entry = &primCache[i];
+		if (!entry->primName) return NULL; // empty slot; not in cache
+		if ((entry->primName == primName) && (entry->setIndex == setIndex)) return entry->primFunc;
+		i = (i + 1) & (PRIM_CACHE_SIZE - 1);
+	}
+	return NULL;
+}
+
+static void primCacheAdd(int setIndex, const char *primName, PrimitiveFunction primFunc) {
+	// Add an entry to the primitive cache. Do nothing if all probed slots are full.
+
+	int i = PRIM_CACHE_HASH(setIndex, primName);
+	for (int probe = 0; probe < PRIM_CACHE_PROBES; probe++) {
+		PrimCacheEntry *entry = &primCache[i];
+		if ((entry->primName == primName) && (entry->setIndex == setIndex)) return; // already cached
+		if (!entry->primName) {
+			entry->primName = primName;
+			entry->primFunc = primFunc;
+			entry->setIndex = setIndex;
+			primCacheCount++;
+			return;
 		}
+		i = (i + 1) & (PRIM_CACHE_SIZE - 1);
 	}
+}
 
-	char s[200];
-	snprintf(s, sizeof(s), "Unknown primitive [%s:%s]", primSets[setIndex].setName, primName);
+void primCacheClear() {
+	memset(primCache, 0, sizeof(primCache));
+	primCacheCount = 0;
+}
+
+void primCacheAddChunk(int chunkIndex) {
+	// Resolve the named primitive calls in the given chunk and add them to the cache.
+
+	if ((chunkIndex < 0) || (chunkIndex >= MAX_CHUNKS)) return;
+	int *code = chunks[chunkIndex].code;
+	if (!code) return;
+
+	int16 *ip = (int16 *) (code + PERSISTENT_HEADER_WORDS);
+	int16 *end = ip + (2 * code[1]); // code[1] is the chunk size in words
+	while (ip < end) {
+		int op = CMD(*ip);
+		if (codeEnd == op) break; // end of instructions; literals and metadata follow
+		if (((commandPrimitive == op) || (reporterPrimitive == op)) && ((ip + 1) < end)) {
+			int16 *nameRef = ip + 1;
+			int setIndex = (*nameRef >> 10) & 0x3F;
+			const char *primName = obj2str((OBJ) (nameRef + (*nameRef & 0x3FF)));
+			PrimitiveFunction f = findPrimitiveInSet(setIndex, primName);
+			if (f) primCacheAdd(setIndex, primName, f);
+		}
+		ip += instructionWords(ip);
+	}
+}
+
+static void primCacheRemoveChunk(int chunkIndex) {
+	// Remove the entries for the call sites in the given chunk, which is about to be replaced
+	// or deleted. Its literals stay in the code store until the next compaction, so otherwise
+	// those entries would fill cache slots that are never used again.
+
+	int *code = chunks[chunkIndex].code;
+	if (!code) return;
+	const char *start = (const char *) code;
+	const char *end = (const char *) (code + PERSISTENT_HEADER_WORDS + code[1]);
+	int removedCount = 0;
+	for (int i = 0; i < PRIM_CACHE_SIZE; i++) {
+		const char *primName = primCache[i].primName;
+		if ((start <= primName) && (primName < end)) {
+			primCache[i].primName = NULL;
+			removedCount++;
+		}
+	}
+	if (!removedCount) return;
+	primCacheCount -= removedCount;
+
+	// re-add the remaining entries so that lookups are not stopped by the newly emptied slots
+	for (int i = 0; i < PRIM_CACHE_SIZE; i++) {
+		PrimCacheEntry entry = primCache[i];
+		if (!entry.primName) continue;
+		primCache[i].primName = NULL;
+		primCacheCount--;
+		primCacheAdd(entry.setIndex, entry.primName, entry.primFunc);
+	}
+}
+
+void primCacheRebuild() {
+	primCacheClear();
+	for (int i = 0; i < MAX_CHUNKS; i++) {
+		if (chunks[i].code) primCacheAddChunk(i);
+	}
+}
+
+static void reportPrimCacheStats() {
+	char s[100];
+	snprintf(s, sizeof(s), "Primitive cache: %d of %d entries used, %lu hits, %lu misses",
+		primCacheCount, PRIM_CACHE_SIZE,
+		(unsigned long) primCacheHits, (unsigned long) primCacheMisses);
 	outputString(s);
-	return fail(primitiveNotImplemented);
+}
+
+OBJ newPrimitiveCall(PrimitiveSetIndex setIndex, const char *primName, int argCount, OBJ *args) {
+	// Call a named primitive with the given primitive set index and name.
 
-	return falseObj;
+	PrimitiveFunction f = primCacheLookup(setIndex, primName);
+	if (f) {
+		primCacheHits++;
+	} else {
+		primCacheMisses++;
+		f = findPrimitiveInSet(setIndex, primName);
+		if (!f) {
+			char s[200];
+			const char *setName = ((int) setIndex < PrimitiveSetCount) ? primSets[setIndex].setName : "?";
+			snprintf(s, sizeof(s), "Unknown primitive [%s:%s]", setName, primName);
+			outputString(s);
+			return fail(primitiveNotImplemented);
+		}
+		primCacheAdd(setIndex, primName, f);
+	}
+
+#ifdef PROFILER
+	if (profiling) {
+		uint32 startUSecs = microsecs();
+		OBJ result = f(argCount, args); // call the primitive
+		tempGCRoot = NULL; // clear tempGCRoot in case it was used
+		profileRecordPrimitive(setIndex, primName, f, microsecs() - startUSecs);
+		return result;
+	}
+#endif
+
+	OBJ result = f(argCount, args); // call the primitive
+	tempGCRoot = NULL; // clear tempGCRoot in case it was used
+	return result;
 }
 
 OBJ callPrimitive(int argCount, OBJ *args) {
@@ -198,11 +398,11 @@ void startTaskForChunk(uint8 chunkIndex) {
 			return; // already running
 		}
 	}
-	for (i = 0; i < MAX_TASKS; i++) {
+	for (i = 0; i < maxTasks; i++) {
 		if (unusedTask == tasks[i].status) break;
 	}
-	if (i >= MAX_TASKS) {
-		outputString("No free task entries");
+	if (i >= maxTasks) {
+		sendTaskError(chunkIndex, tooManyTasks, chunkIndex);
 		return;
 	}
 
@@ -215,6 +415,7 @@ void startTaskForChunk(uint8 chunkIndex) {
 	tasks[i].sp = 0; // relative to start of stack
 	tasks[i].fp = 0; // 0 means "not in a function call"
 	if (i >= taskCount) taskCount = i + 1;
+	scheduleTask(i);
 	sendMessage(taskStartedMsg, chunkIndex, 0, NULL);
 }
 
@@ -271,13 +472,10 @@ void stopAllTasksButThis(Task *thisTask) {
 	}
 }
 
-// Selected Opcodes (see MicroBlocksCompiler.gp for complete set)
-
-#define pushLiteral 5
-#define initLocals 9
-#define recvBroadcast 41
+static OBJ broadcastLiteral(uint8 chunkIndex) {
+	// Return the message string literal of the broadcast hat of the given chunk or NULL
+	// if the chunk does not start with a broadcast hat. The literal is a read-only string.
 
-int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
 	int16 *code = (int16 *) (chunks[chunkIndex].code + PERSISTENT_HEADER_WORDS);
 	// First three instructions of a broadcast hat should be:
 	//	initLocals
@@ -289,9 +487,15 @@ int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
 	if ((initLocals != CMD(code[0])) ||
 		(pushLiteral != CMD(code[1])) ||
 		(recvBroadcast != CMD(code[3])))
-			return false;
+			return NULL;
 	code++; // skip initLocals
-	char *s = obj2str((OBJ) (code + *(code + 1) + 1));
+	return (OBJ) (code + *(code + 1) + 1);
+}
+
+int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
+	OBJ literal = broadcastLiteral(chunkIndex);
+	if (!literal) return false;
+	char *s = obj2str(literal);
 	if (strlen(s) == 0) return true; // empty parameter in the receiver means "any message"
 	if (strlen(s) != byteCount) return false;
 	for (int i = 0; i < byteCount; i++) {
@@ -304,14 +508,29 @@ extern OBJ lastBroadcast;
 
 void startReceiversOfBroadcast(char *msg, int byteCount) {
 	// Start tasks for chunks with hat blocks matching the given broadcast if not already running.
+	// If a receiver's hat has the message as its literal, use that read-only string as
+	// lastBroadcast rather than copying the message into the object store.
 
-	lastBroadcast = newStringFromBytes(msg, byteCount);
+	OBJ msgLiteral = NULL;
 	for (int i = 0; i < MAX_CHUNKS; i++) {
 		int chunkType = chunks[i].chunkType;
 		if (((broadcastHat == chunkType) || (functionHat == chunkType)) && (broadcastMatches(i, msg, byteCount))) {
+			OBJ literal = broadcastLiteral(i);
+			if (byteCount && (byteCount == (int) strlen(obj2str(literal)))) msgLiteral = literal;
 			startTaskForChunk(i); // only starts a new task if if chunk is not already running
 		}
 	}
+	lastBroadcast = msgLiteral ? msgLiteral : newStringFromBytes(msg, byteCount);
+}
+
+void copyBroadcastLiteral() {
+	// If lastBroadcast is a string literal in a code chunk, replace it with a copy in the
+	// object store. Called when a chunk is stored or deleted and before the code store is
+	// compacted or cleared, since the literal may then be moved or overwritten.
+
+	if (!isReadOnly(lastBroadcast)) return;
+	OBJ copy = newStringFromBytes(obj2str(lastBroadcast), strlen(obj2str(lastBroadcast)));
+	lastBroadcast = copy ? copy : zeroObj;
 }
 
 // Button Hat Support
@@ -422,15 +641,183 @@ void checkButtons() {
 	}
 }
 
+// Chunk Metadata
+
+int metadataOffset(uint8 *code, int byteCount) {
+	// Return the byte offset of the decompiler metadata in the given chunk code or -1 if
+	// there is none. The metadata follows the instructions and the literals. It starts with
+	// metadataTag followed by the null-terminated function name. The code must be 16-bit
+	// aligned.
+
+	int16 *ip = (int16 *) code;
+	int16 *end = (int16 *) (code + byteCount);
+	while ((ip < end) && (codeEnd != CMD(*ip))) ip += instructionWords(ip);
+	int offset = (((uint8 *) (ip + 1) - code) + 3) & ~3; // literals start at a word boundary
+	while ((offset + 4) <= byteCount) {
+		uint8 *p = &code[offset];
+		if (metadataTag == p[0]) return offset;
+		if (StringType != (p[0] & 0xF)) return -1; // not a string literal; should not happen
+		int literalWords = (p[0] >> 4) | (p[1] << 4) | (p[2] << 12) | (p[3] << 20);
+		offset += 4 * (literalWords + 1);
+	}
+	return -1;
+}
+
+// Compact Chunk Records
+
+// When built with -DCOMPACT_CHUNKS, chunks are stored without most of the metadata that the
+// IDE appends for its decompiler (function library, block spec, and local variable names),
+// which is often as large as the code itself. This lets a board with a small code store
+// hold larger programs. Such chunks are stored in chunkCodeCompact records. Function chunks
+// keep the metadata tag and the function name, so calling a function by name still works;
+// the rest of the metadata is dropped. The last word of a compact record is the CRC of the
+// chunk as sent by the IDE, so the IDE sees the CRC it expects and does not resend the
+// chunk. Chunks read back from such a board are decompiled without metadata, so functions,
+// parameters, and local variables get generic names and custom blocks lose their layout.
+// For that reason, compact records are not used unless COMPACT_CHUNKS is defined.
+
+#if COMPACT_CHUNKS
+static uint32_t crc32Bytes(uint8 *bytes, int byteCount);
+#endif
+
+static int compactChunkCode(uint8 *code, int byteCount, int chunkType) {
+	// If compact chunks are enabled, replace the decompiler metadata of the given chunk code
+	// with the CRC of the original code and return the new byte count. For function chunks,
+	// keep the metadata tag and the function name, padded with 0xFF bytes to a word boundary
+	// (0xFF is not valid in UTF-8, so the IDE's decompiler finds no further metadata strings). Return zero
+	// if the chunk was not changed. The code must be 16-bit aligned.
+
+	#if COMPACT_CHUNKS
+		int offset = metadataOffset(code, byteCount);
+		if (offset < 0) return 0; // no metadata
+		int keepBytes = 0; // metadata bytes to keep
+		if (functionHat == chunkType) {
+			uint8 *nameEnd = memchr(&code[offset + 1], 0, byteCount - (offset + 1));
+			if (!nameEnd) return 0; // unterminated function name; should not happen
+			keepBytes = (nameEnd + 1) - &code[offset];
+		}
+		int crcOffset = (offset + keepBytes + 3) & ~3;
+		if ((crcOffset + 4) >= byteCount) return 0; // nothing to save
+		uint32 crc = crc32Bytes(code, byteCount);
+		memset(&code[offset + keepBytes], 0xFF, crcOffset - (offset + keepBytes)); // padding
+		memcpy(&code[crcOffset], &crc, 4);
+		return crcOffset + 4;
+	#else
+		return 0;
+	#endif
+}
+
 // Store Ops
 
-static void storeCodeChunk(uint8 chunkIndex, int byteCount, uint8 *data) {
+static void installCodeChunk(int chunkIndex, int chunkType, int *persistentChunk) {
+	copyBroadcastLiteral();
+	primCacheRemoveChunk(chunkIndex);
+	chunks[chunkIndex].code = persistentChunk;
+	chunks[chunkIndex].crc = persistentChunk ? chunkCRC(persistentChunk) : 0;
+	chunks[chunkIndex].chunkType = chunkType;
+	primCacheAddChunk(chunkIndex);
+}
+
+void storeCodeChunk(uint8 chunkIndex, int byteCount, uint8 *data) {
 	if (chunkIndex >= MAX_CHUNKS) return;
 	stopTaskForChunk(chunkIndex);
 	int chunkType = data[0]; // first byte is the chunk type
-	int *persistenChunk = appendPersistentRecord(chunkCode, chunkIndex, chunkType, byteCount - 1, &data[1]);
-	chunks[chunkIndex].code = persistenChunk;
-	chunks[chunkIndex].chunkType = chunkType;
+	int recordType = chunkCode;
+	int codeBytes = byteCount - 1;
+	int compactBytes = compactChunkCode(&data[1], codeBytes, chunkType);
+	if (compactBytes) {
+		recordType = chunkCodeCompact;
+		codeBytes = compactBytes;
+	}
+	int *persistentChunk = appendPersistentRecord(recordType, chunkIndex, chunkType, codeBytes, &data[1]);
+	installCodeChunk(chunkIndex, chunkType, persistentChunk);
+	clearCalleeCache();
+}
+
+// Chunk Batches
+
+// The IDE can send a series of chunks as a batch of chunkBatchMsg messages, each tagged
+// with a sequence number. The chunks are collected in batchBuf, already formatted as code
+// store records, and written to the code store with a single appendPersistentRecords() call
+// when the batch ends, when the buffer is full, or when any other message arrives. A chunk
+// that arrives out of sequence (e.g. because a message was dropped) is ignored, as are all
+// chunks after it. The IDE asks for a chunkBatchAckMsg at the end of each window of chunks
+// and resends any chunks after the last sequence number the board reports.
+
+// The buffer size depends on the RAM available. On boards where it is zero, batched
+// chunks are stored individually as they arrive.
+
+#if defined(NRF51) || defined(ARDUINO_ARCH_SAMD)
+	#define CHUNK_BATCH_WORDS 0 // not enough RAM (16k or 32k)
+#elif defined(ESP8266)
+	#define CHUNK_BATCH_WORDS 256 // 80k RAM
+#elif defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define CHUNK_BATCH_WORDS 2048
+#else
+	#define CHUNK_BATCH_WORDS 512
+#endif
+
+static int batchBuf[CHUNK_BATCH_WORDS + 1]; // extra word avoids a zero-length array
+static int batchWordCount = 0;
+static int batchLastSeq = -1; // sequence number of the last chunk received in order
+
+static void commitChunkBatch() {
+	// Write the batched chunks to the code store and install them.
+
+	if (!batchWordCount) return;
+	int *persistentBatch = appendPersistentRecords(batchBuf, batchWordCount);
+	int i = 0;
+	while (i < batchWordCount) {
+		int header = batchBuf[i];
+		int chunkIndex = (header >> 8) & 0xFF;
+		stopTaskForChunk(chunkIndex);
+		installCodeChunk(chunkIndex, header & 0xFF, persistentBatch ? persistentBatch + i : NULL);
+		i += PERSISTENT_HEADER_WORDS + batchBuf[i + 1];
+	}
+	clearCalleeCache();
+	batchWordCount = 0;
+}
+
+static void addChunkToBatch(uint8 chunkIndex, int byteCount, uint8 *data) {
+	// Add the chunk in a chunkBatchMsg to the batch.
+	// Message body: <sequence number (two bytes, LSB first)><chunk type><chunk code>
+
+	if (byteCount < 3) return;
+	int seq = data[0] | (data[1] << 8);
+	if (0 == seq) batchLastSeq = -1; // start of a new batch
+	if (seq != (batchLastSeq + 1)) return; // out of sequence; ignore
+	batchLastSeq = seq;
+	if (chunkIndex >= MAX_CHUNKS) return;
+
+	int codeBytes = byteCount - 3;
+	int recordWords = PERSISTENT_HEADER_WORDS + ((codeBytes + 3) / 4);
+	if (recordWords > CHUNK_BATCH_WORDS) { // too large to batch
+		commitChunkBatch(); // preserve chunk order
+		storeCodeChunk(chunkIndex, byteCount - 2, &data[2]);
+		return;
+	}
+	if ((batchWordCount + recordWords) > CHUNK_BATCH_WORDS) commitChunkBatch();
+
+	int *rec = &batchBuf[batchWordCount];
+	int recordType = chunkCode;
+	rec[recordWords - 1] = 0; // clear padding bytes of the last word
+	memcpy(&rec[PERSISTENT_HEADER_WORDS], &data[3], codeBytes);
+	int compactBytes = compactChunkCode((uint8 *) &rec[PERSISTENT_HEADER_WORDS], codeBytes, data[2]);
+	if (compactBytes) {
+		recordType = chunkCodeCompact;
+		recordWords = PERSISTENT_HEADER_WORDS + (compactBytes / 4);
+	}
+	rec[0] = PERSISTENT_HEADER(recordType, chunkIndex, data[2]);
+	rec[1] = recordWords - PERSISTENT_HEADER_WORDS;
+	batchWordCount += recordWords;
+}
+
+static void sendChunkBatchAck() {
+	// Report the sequence number of the last chunk received in order (0xFFFF if none).
+
+	char seqBytes[2] = { batchLastSeq & 0xFF, (batchLastSeq >> 8) & 0xFF };
+	sendMessage(chunkBatchAckMsg, 0, 2, seqBytes);
+	sendData();
 }
 
 static void storeVarName(uint8 varIndex, int byteCount, uint8 *data) {
@@ -447,9 +834,12 @@ static void storeVarName(uint8 varIndex, int byteCount, uint8 *data) {
 static void deleteCodeChunk(uint8 chunkIndex) {
 	if (chunkIndex >= MAX_CHUNKS) return;
 	stopTaskForChunk(chunkIndex);
+	copyBroadcastLiteral();
+	primCacheRemoveChunk(chunkIndex);
 	chunks[chunkIndex].code = NULL;
 	chunks[chunkIndex].chunkType = unusedChunk;
 	appendPersistentRecord(chunkDeleted, chunkIndex, 0, 0, NULL);
+	clearCalleeCache();
 }
 
 static void deleteAllChunks() {
@@ -461,6 +851,8 @@ static void deleteAllChunks() {
 		appendPersistentRecord(deleteAll, 0, 0, 0, NULL);
 	#endif
 	memset(chunks, 0, sizeof(chunks));
+	primCacheClear();
+	clearCalleeCache();
 }
 
 static void clearAllVariables() {
@@ -691,6 +1083,23 @@ static void sendValueMessage(uint8 msgType, uint8 chunkOrVarIndex, OBJ value) {
 			}
 		}
 		sendMessage(msgType, chunkOrVarIndex, (dst - data), data);
+	} else if (IS_PACKED_ARRAY(value)) {
+		data[0] = 4; // data type (4 is list); the IDE shows a packed array as a list of integers
+		char *dst = &data[1];
+		int itemCount = packedArrayCount(value);
+		*dst++ = itemCount & 0xFF;
+		*dst++ = (itemCount >> 8) & 0xFF;
+		int sendCount = (itemCount < 32) ? itemCount : 32; // send up to 32 items
+		*dst++ = sendCount;
+		for (int i = 0; i < sendCount; i++) {
+			int n = packedArrayAt(value, i);
+			*dst++ = 1; // item type (1 is integer)
+			*dst++ = (n & 0xFF);
+			*dst++ = ((n >> 8) & 0xFF);
+			*dst++ = ((n >> 16) & 0xFF);
+			*dst++ = ((n >> 24) & 0xFF);
+		}
+		sendMessage(msgType, chunkOrVarIndex, (dst - data), data);
 	} else if (IS_TYPE(value, ByteArrayType)) {
 		data[0] = 5; // data type (5 is bytearray)
 		char *dst = &data[1];
@@ -858,24 +1267,54 @@ const uint32_t crcTable[] = {
 0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D};
 
-uint32_t crc32(uint8_t *buf, int byteCount) {
+#if COMPACT_CHUNKS
+
+static uint32_t crc32Bytes(uint8 *bytes, int byteCount) {
+	// Compute the CRC-32 of the given bytes a byte at a time. Used for data that may not
+	// be word aligned.
+
 	uint32_t crc = ~0;
-	uint8_t *end = buf + byteCount;
-	for (uint8_t *p = buf; p < end; p++) {
-		crc = (crc >> 8) ^ crcTable[(crc & 0xff) ^ *p];
+	for (int i = 0; i < byteCount; i++) {
+		crc = (crc >> 8) ^ crcTable[(crc ^ bytes[i]) & 0xFF];
 	}
 	return ~crc;
 }
 
+#endif
+
+static uint32_t crc32Words(uint32_t *words, int wordCount) {
+	// Compute the CRC-32 of the given words a word at a time. Since all supported processors
+	// are little-endian, XOR-ing a whole word into the CRC and then doing four table steps gives
+	// the same result as processing its four bytes one at a time, with a quarter of the loads.
+
+	uint32_t crc = ~0;
+	uint32_t *end = words + wordCount;
+	for (uint32_t *p = words; p < end; p++) {
+		crc ^= *p;
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+	}
+	return ~crc;
+}
+
+uint32 chunkCRC(OBJ code) {
+	// Return the CRC-32 of the given code chunk, a record in the persistent store.
+
+	int wordCount = *(code + 1); // size is the second word in the persistent store record
+	if (chunkCodeCompact == ((*code >> 16) & 0xFF)) { // CRC is stored in the last word
+		return (uint32) *(code + PERSISTENT_HEADER_WORDS + wordCount - 1);
+	}
+	return crc32Words((uint32_t *) (code + PERSISTENT_HEADER_WORDS), wordCount);
+}
+
 static void sendChunkCRC(int chunkID) {
 	// Send the 4-byte CRC-32 for the given chunk. Do nothing if the chunk is not in use.
 
 	if ((chunkID < 0) || (chunkID >= MAX_CHUNKS)) return;
-	OBJ code = chunks[chunkID].code;
-	if (code) {
-		int wordCount = *(code + 1); // size is the second word in the persistent store record
-		uint8_t *chunkData = (uint8_t *) (code + PERSISTENT_HEADER_WORDS);
-		uint32_t crc = crc32(chunkData, (4 * wordCount));
+	if (chunks[chunkID].code) {
+		uint32_t crc = chunks[chunkID].crc;
 		waitForOutbufBytes(9);
 		sendMessage(chunkCRCMsg, chunkID, 4, (char *) &crc);
 		sendData();
@@ -903,10 +1342,7 @@ void sendAllCRCs() {
 	int delayPerCRC = extraByteDelay / 250;  // msec delay for 4 bytes (extraByteDelay is in usecs)
 	for (int i = 0; i < MAX_CHUNKS; i++) {
 		if (chunks[i].code) {
-			OBJ code = chunks[i].code;
-			int wordCount = *(code + 1); // size is the second word in the persistent store record
-			uint8_t *chunkData = (uint8_t *) (code + PERSISTENT_HEADER_WORDS);
-			uint32_t crc = crc32(chunkData, (4 * wordCount));
+			uint32_t crc = chunks[i].crc;
 			char *crcBytes = (char *) &crc;
 			waitForOutbufBytes(5);
 			queueByte(i);
@@ -914,12 +1350,49 @@ void sendAllCRCs() {
 			queueByte(crcBytes[1]);
 			queueByte(crcBytes[2]);
 			queueByte(crcBytes[3]);
-			delay(delayPerCRC);
+			if (delayPerCRC) delay(delayPerCRC);
 		}
 	}
 	deferIDEDisconnect();
 }
 
+static void sendTaskStats() {
+	// Send the stack size and stack high-water mark of each task that is running or has run.
+	// The first data byte is the maximum number of tasks. It is followed by a 6-byte record
+	// for each task: chunkID, status, stack size (2 bytes), and stack high-water mark (2 bytes).
+	// Sizes are in words, least significant byte first.
+
+	int recordCount = 0;
+	for (int i = 0; i < maxTasks; i++) {
+		if (tasks[i].status || tasks[i].stackHighWater) recordCount++;
+	}
+
+	// send message header
+	int dataSize = 1 + (6 * recordCount);
+	waitForOutbufBytes(6);
+	queueByte(251);
+	queueByte(taskStatsMsg);
+	queueByte(0);
+	queueByte(dataSize & 0xFF); // low byte of size
+	queueByte((dataSize >> 8) & 0xFF); // high byte of size
+	queueByte(maxTasks);
+
+	// send task records
+	for (int i = 0; i < maxTasks; i++) {
+		Task *task = &tasks[i];
+		if (task->status || task->stackHighWater) {
+			int highWater = taskStackHighWater(task);
+			waitForOutbufBytes(6);
+			queueByte(task->taskChunkIndex);
+			queueByte(task->status);
+			queueByte(task->stackSize & 0xFF);
+			queueByte((task->stackSize >> 8) & 0xFF);
+			queueByte(highWater & 0xFF);
+			queueByte((highWater >> 8) & 0xFF);
+		}
+	}
+}
+
 // Retrieving source code
 
 static void sendCodeChunk(int chunkID, int chunkType, int chunkBytes, char *chunkData) {
@@ -947,6 +1420,7 @@ static void sendAllCode() {
 
 		int chunkType = chunks[chunkID].chunkType;
 		int chunkWords = *(code + 1); // chunk word count is second word of persistent store record
+		if (chunkCodeCompact == ((*code >> 16) & 0xFF)) chunkWords--; // don't send the CRC
 		char *chunkData = (char *) (code + PERSISTENT_HEADER_WORDS);
 		sendCodeChunk(chunkID, chunkType, (4 * chunkWords), chunkData);
 		sendData();
@@ -1023,7 +1497,7 @@ int indexOfVarNamed(const char *s) {
 
 #define RCVBUF_SIZE 1024
 #define MAX_MSG_SIZE (RCVBUF_SIZE - 10) // 5 header + 1 terminator bytes plus a few extra
-static uint8 rcvBuf[RCVBUF_SIZE];
+static uint8 rcvBuf[RCVBUF_SIZE] __attribute__ ((aligned (4))); // keeps chunk code 16-bit aligned
 static int rcvByteCount = 0;
 uint32 lastRcvTime = 0;
 
@@ -1093,7 +1567,12 @@ static void processShortMessage() {
 	}
 	int cmd = rcvBuf[1];
 	int chunkIndex = rcvBuf[2];
+	if (cmd != chunkBatchAckMsg) commitChunkBatch();
 	switch (cmd) {
+	case chunkBatchAckMsg:
+		if (chunkIndex) commitChunkBatch(); // end of batch
+		sendChunkBatchAck();
+		break;
 	case deleteChunkMsg:
 		deleteCodeChunk(chunkIndex);
 		break;
@@ -1133,6 +1612,12 @@ static void processShortMessage() {
 		sendPingNow(chunkIndex); // send a ping to acknowledge receipt
 		sendAllCRCs();
 		break;
+	case getTaskStatsMsg:
+		sendTaskStats();
+		break;
+	case profileMsg:
+		processProfileMsg(chunkIndex);
+		break;
 	case getVersionMsg:
 		sendVersionString();
 		break;
@@ -1153,6 +1638,9 @@ static void processShortMessage() {
 		// non-zero chunkIndex is used for debugging operations
 		if (1 == chunkIndex) { outputRecordHeaders(); break; }
 		if (2 == chunkIndex) { compactCodeStore(); break; }
+		if (4 == chunkIndex) { reportPrimCacheStats(); break; }
+		if (5 == chunkIndex) { reportSlowPathCounts(); break; }
+		if (6 == chunkIndex) { reportHeapStats(); break; }
 		if (3 == chunkIndex) { primMBDisplayOff(0, NULL); } // used by Boardie reset
 		softReset(true);
 		break;
@@ -1190,12 +1678,16 @@ static void processLongMessage() {
 	int cmd = rcvBuf[1];
 	int chunkIndex = rcvBuf[2];
 	int bodyBytes = msgLength - 1; // subtract terminator byte
+	if (cmd != chunkBatchMsg) commitChunkBatch();
 	switch (cmd) {
 	case chunkCode16Msg: // code chunk from 16-bit IDE
 		sendPingNow(chunkIndex); // send a ping to acknowledge receipt
 		storeCodeChunk(chunkIndex, bodyBytes, &rcvBuf[5]);
 		sendChunkCRC(chunkIndex);
 		break;
+	case chunkBatchMsg:
+		addChunkToBatch(chunkIndex, bodyBytes, &rcvBuf[5]);
+		break;
 	case setVarMsg:
 		setVariableValue(rcvBuf[2], bodyBytes, &rcvBuf[5]);
 		break;
@@ -1242,7 +1734,13 @@ void processMessage() {
 	// uncomment to check for serial buffer overruns:
 	// if (bytesRead > 49) reportNum("bytesRead", bytesRead);
 	rcvByteCount += bytesRead;
-	if (!rcvByteCount) return;
+	if (!rcvByteCount) {
+		if ((microsecs() - lastRcvTime) > 500000) { // the IDE is idle
+			commitChunkBatch(); // commit a batch left pending, e.g. if the IDE disconnected
+			syncCodeStore();
+		}
+		return;
+	}
 
 	// the following is needed when built on mbed to avoid dropped bytes
 // 	while (bytesRead > 0) {
@@ -1261,4 +1759,7 @@ void processMessage() {
 	} else {
 		skipToStartByteAfter(1); // bad message, probably due to dropped bytes
 	}
+#ifdef PROFILER
+	if (profiling) profileRecordMessage(microsecs() - lastRcvTime);
+#endif
 }
@@ -2740,12 +2740,22 @@ OBJ primCaptureCount(int argCount, OBJ *args) {
 }
 
 OBJ primCaptureEnd(int argCount, OBJ *args) {
+	// Return the captured pulse times as a list or, if the optional argument is true,
+	// as an Int16Array, which takes half the memory and is not scanned by the GC.
+
 	detachInterrupt(pulsePin); // stop pin change interrupts, if any
 	pulsePin = -1;
 
 	int count = pulseIndex;
 	pulseIndex = 0; // clear capture
 
+	if ((argCount > 0) && (trueObj == args[0])) {
+		OBJ result = newPackedArray(Int16ArrayType, count);
+		if (!result) return falseObj; // allocation failed
+		memcpy(&FIELD(result, 0), pulseTimes, 2 * count);
+		return result;
+	}
+
 	OBJ result = newObj(ListType, count + 1, falseObj);
 	if (!result) return falseObj; // allocation failed
 